@@ -0,0 +1,217 @@
+/*
+ * bundle.c - Unlambda executable bundler
+ * 
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "bundle.h"
+#include "logging.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <libgen.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#ifndef U6A_LIBDIR
+#define U6A_LIBDIR "/usr/local/lib"
+#endif
+#ifndef U6A_INCLUDEDIR
+#define U6A_INCLUDEDIR "/usr/local/include"
+#endif
+#ifndef U6A_SRCDIR
+#define U6A_SRCDIR U6A_INCLUDEDIR
+#endif
+#ifndef U6A_LIBS
+#define U6A_LIBS ""
+#endif
+
+#define BUNDLE_MAX_ARGS    64
+#define BUNDLE_LIB_FILE    "libu6a.a"
+#define BUNDLE_HEADER_FILE "u6a_native.h"
+#define BUNDLE_TMP_FILE    "/u6acXXXXXX.c"
+
+extern char** environ;
+
+static const char* err_bundle = "bundle error";
+static const char* info_bundle = "bundle";
+
+// Splits words of str into args, returns false if there are too many
+static inline bool
+split_args(char* str, char** args, uint32_t* args_len) {
+    for (char* word = strtok(str, " \t"); word; word = strtok(NULL, " \t")) {
+        if (UNLIKELY(*args_len == BUNDLE_MAX_ARGS - 1)) {
+            return false;
+        }
+        args[(*args_len)++] = word;
+    }
+    return true;
+}
+
+FILE*
+u6a_bundle_tmp_file(char** file_name) {
+    const char* tmp_dir = getenv("TMPDIR");
+    if (tmp_dir == NULL || *tmp_dir == '\0') {
+        tmp_dir = "/tmp";
+    }
+    const size_t size = strlen(tmp_dir) + sizeof(BUNDLE_TMP_FILE);
+    *file_name = malloc(size);
+    if (UNLIKELY(*file_name == NULL)) {
+        u6a_err_bad_alloc(err_bundle, size);
+        return NULL;
+    }
+    strcpy(*file_name, tmp_dir);
+    strcat(*file_name, BUNDLE_TMP_FILE);
+    const int fd = mkstemps(*file_name, sizeof(".c") - 1);
+    FILE* file = fd < 0 ? NULL : fdopen(fd, "w");
+    if (UNLIKELY(file == NULL)) {
+        u6a_err_cannot_open_file(err_bundle, *file_name);
+        if (fd >= 0) {
+            close(fd);
+            remove(*file_name);
+        }
+        free(*file_name);
+        *file_name = NULL;
+    }
+    return file;
+}
+
+// Finds path of the running u6ac, which may be unknown
+static inline bool
+self_path(const char* argv0, char* path) {
+    const ssize_t len = readlink("/proc/self/exe", path, PATH_MAX - 1);
+    if (len > 0) {
+        path[len] = '\0';
+        return true;
+    }
+    return strchr(argv0, '/') && realpath(argv0, path);
+}
+
+// Writes dir to found if it holds the file
+static inline bool
+file_exists(const char* dir, const char* file, char* found) {
+    if (UNLIKELY(strlen(dir) + strlen(file) + 2 > PATH_MAX)) {
+        return false;
+    }
+    strcpy(found, dir);
+    strcat(found, "/");
+    strcat(found, file);
+    const bool exists = access(found, R_OK) == 0;
+    strcpy(found, dir);
+    return exists;
+}
+
+// Files shared with the runtime are looked for next to u6ac (e.g. in the build tree), then in the given
+// directory of the prefix u6ac is installed into, and finally in those configured on build
+static bool
+find_dir(const char* argv0, const char* file, const char* prefix_dir, const char* const* configured, char* found) {
+    char path[PATH_MAX];
+    if (self_path(argv0, path)) {
+        const char* dir = dirname(path);
+        if (file_exists(dir, file, found)) {
+            return true;
+        }
+        char sibling[PATH_MAX];
+        if (strlen(dir) + strlen(prefix_dir) + 5 <= PATH_MAX) {
+            strcpy(sibling, dir);
+            strcat(sibling, "/../");
+            strcat(sibling, prefix_dir);
+            if (file_exists(sibling, file, found)) {
+                return true;
+            }
+        }
+    }
+    for (; *configured; ++configured) {
+        if (file_exists(*configured, file, found)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+u6a_bundle_link(const char* c_file_name, const char* exe_file_name, const char* argv0) {
+    static const char* const lib_dirs[] = { U6A_LIBDIR, NULL };
+    // Header is also found in source tree, where it is not built alongside u6ac
+    static const char* const include_dirs[] = { U6A_INCLUDEDIR, U6A_SRCDIR, NULL };
+    char lib_dir[PATH_MAX + 2] = "-L";
+    char include_dir[PATH_MAX + 2] = "-I";
+    if (UNLIKELY(!find_dir(argv0, BUNDLE_LIB_FILE, "lib", lib_dirs, lib_dir + 2))) {
+        u6a_err_custom(err_bundle, "runtime library " BUNDLE_LIB_FILE " found neither next to u6ac nor in "
+            U6A_LIBDIR ", try \"make install\"");
+        return false;
+    }
+    if (UNLIKELY(!find_dir(argv0, BUNDLE_HEADER_FILE, "include", include_dirs, include_dir + 2))) {
+        u6a_err_custom(err_bundle, "header " BUNDLE_HEADER_FILE " found neither next to u6ac nor in "
+            U6A_INCLUDEDIR ", try \"make install\"");
+        return false;
+    }
+    // Compiler may be given along with flags, e.g. CC="gcc -m64"
+    const char* cc_env = getenv("CC");
+    char* cc = strdup(cc_env && *cc_env ? cc_env : "cc");
+    char* libs = strdup(U6A_LIBS);
+    if (UNLIKELY(cc == NULL || libs == NULL)) {
+        u6a_err_bad_alloc(err_bundle, strlen(U6A_LIBS) + 1);
+        goto bundle_failed;
+    }
+    char* args[BUNDLE_MAX_ARGS];
+    uint32_t args_len = 0;
+    if (UNLIKELY(!split_args(cc, args, &args_len))) {
+        goto too_many_args;
+    }
+    if (args_len == 0) {
+        // CC holding nothing but blanks is taken as unset
+        args[args_len++] = "cc";
+    }
+    const char* fixed_args[] = { "-O2", include_dir, "-o", exe_file_name, c_file_name, lib_dir, "-lu6a" };
+    const uint32_t fixed_len = sizeof(fixed_args) / sizeof(const char*);
+    // Room is left for the terminating NULL, as split_args() does
+    if (UNLIKELY(args_len + fixed_len > BUNDLE_MAX_ARGS - 1)) {
+        goto too_many_args;
+    }
+    for (uint32_t idx = 0; idx < fixed_len; ++idx) {
+        args[args_len++] = (char*)fixed_args[idx];
+    }
+    if (UNLIKELY(!split_args(libs, args, &args_len))) {
+        goto too_many_args;
+    }
+    args[args_len] = NULL;
+    u6a_info_verbose(info_bundle, "linking with %s, runtime library from %s, header from %s", args[0], lib_dir + 2,
+        include_dir + 2);
+    pid_t pid;
+    int status;
+    if (UNLIKELY(posix_spawnp(&pid, args[0], NULL, NULL, args, environ) != 0)) {
+        u6a_err_custom(err_bundle, "failed to start C compiler");
+        goto bundle_failed;
+    }
+    if (UNLIKELY(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+        u6a_err_custom(err_bundle, "C compiler failed");
+        goto bundle_failed;
+    }
+    free(cc);
+    free(libs);
+    return true;
+
+    too_many_args:
+    u6a_err_custom(err_bundle, "too many arguments for C compiler");
+    bundle_failed:
+    free(cc);
+    free(libs);
+    return false;
+}
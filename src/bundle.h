@@ -0,0 +1,37 @@
+/*
+ * bundle.h - Unlambda executable bundler definitions
+ * 
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef U6A_BUNDLE_H_
+#define U6A_BUNDLE_H_
+
+#include "common.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// Compiles the given C file written by codegen, and links it against the runtime library into an executable.
+// The library is looked for relative to u6ac, which is found by argv0 if the system does not tell.
+bool
+u6a_bundle_link(const char* c_file_name, const char* exe_file_name, const char* argv0);
+
+// Creates a temporary file for C code to be linked, in $TMPDIR if set, otherwise /tmp
+FILE*
+u6a_bundle_tmp_file(char** file_name);
+
+#endif
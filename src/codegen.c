@@ -18,15 +18,14 @@
  */
 
 #include "codegen.h"
+#include "codegen_c.h"
+#include "optimizer.h"
 #include "logging.h"
 #include "vm_defs.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
-#include <arpa/inet.h>
-
-#define OPTIMIZE_STR_MIN_LEN 0x04
 
 #define WRITE_SECION(buffer, type_size, len, ostream)                \
     if (UNLIKELY(len != fwrite(buffer, type_size, len, ostream))) {  \
@@ -36,7 +35,11 @@
 
 static FILE*       output_stream;
 static const char* file_name;
-static bool        optimize_const;
+static enum u6a_codegen_target target;
+static uint32_t    prefix_len;
+
+static const char  padding[U6A_BC_SECTION_ALIGN];
+static const struct u6a_vm_ins text_subst[] = U6A_VM_TEXT_SUBST;
 
 static const char* err_codegen = "codegen error";
 static const char* info_codegen = "codegen";
@@ -47,7 +50,9 @@ struct ins_with_offset {
 };
 
 static inline bool
-write_bc_header(FILE* restrict output_stream, uint32_t text_len, uint32_t rodata_len) {
+write_bc_header(FILE* restrict output_stream, uint32_t text_size, uint32_t rodata_size, uint32_t text_offset,
+                uint32_t rodata_offset, uint32_t features) {
+    // Program header and sections are written in native byte order, so that they can be used in place
     struct u6a_bc_header header = {
         .file = {
             .magic            = U6A_MAGIC,
@@ -56,8 +61,12 @@ write_bc_header(FILE* restrict output_stream, uint32_t text_len, uint32_t rodata
             .prog_header_size = U6A_BC_PROG_HEADER_SIZE
         },
         .prog = {
-            .text_size        = htonl(text_len * sizeof(struct u6a_vm_ins)),
-            .rodata_size      = htonl(rodata_len * sizeof(uint8_t))
+            .byte_order       = U6A_BC_BYTE_ORDER,
+            .text_size        = text_size,
+            .rodata_size      = rodata_size,
+            .text_offset      = text_offset,
+            .rodata_offset    = rodata_offset,
+            .features         = features
         }
     };
     return 1 == fwrite(&header, sizeof(struct u6a_bc_header), 1, output_stream);
@@ -73,27 +82,42 @@ u6a_write_prefix(const char* prefix_string) {
         u6a_err_write_failed(err_codegen, write_length, file_name);
         return false;
     }
+    prefix_len = write_length;
     u6a_info_verbose(info_codegen, "prefix string written, %" PRIu32 " chars total", write_length);
     return true;
 }
 
 void
-u6a_codegen_init(FILE* output_stream_, const char* file_name_, bool optimize_const_) {
+u6a_codegen_init(FILE* output_stream_, const char* file_name_, enum u6a_codegen_target target_) {
     output_stream = output_stream_;
     file_name = file_name_;
-    optimize_const = optimize_const_;
+    target = target_;
+    prefix_len = 0;
+}
+
+// Index past the last node of a subtree
+static inline uint32_t
+subtree_end(const struct u6a_ast_node* ast_arr, uint32_t node_idx) {
+    while (U6A_AN_FN(ast_arr + node_idx) == u6a_tf_app) {
+        node_idx = U6A_AN_RIGHT(ast_arr + node_idx, ast_arr) - ast_arr;
+    }
+    return node_idx + 1;
 }
 
 bool
 u6a_codegen(struct u6a_ast_node* ast_arr, uint32_t ast_len) {
-    void* bc_buffer = calloc(ast_len, sizeof(struct u6a_vm_ins) + sizeof(char));
+    // Each char of a string takes two AST nodes, so three bytes per node leave room for length fields and padding
+    const uint32_t text_buffer_size = (U6A_VM_TEXT_SUBST_LEN + ast_len) * sizeof(struct u6a_vm_ins);
+    const uint32_t bc_buffer_size = text_buffer_size + ast_len * 3;
+    void* bc_buffer = calloc(bc_buffer_size, 1);
     if (UNLIKELY(bc_buffer == NULL)) {
-        u6a_err_bad_alloc(err_codegen, ast_len * (sizeof(struct u6a_vm_ins) + sizeof(char)));
+        u6a_err_bad_alloc(err_codegen, bc_buffer_size);
         return false;
     }
     struct u6a_vm_ins* text_buffer = bc_buffer;
-    char* rodata_buffer = (char*)(text_buffer + ast_len);
-    uint32_t text_len = 0;
+    char* rodata_buffer = (char*)bc_buffer + text_buffer_size;
+    memcpy(text_buffer, text_subst, sizeof(text_subst));
+    uint32_t text_len = U6A_VM_TEXT_SUBST_LEN;
     uint32_t rodata_len = 0;
     struct ins_with_offset* stack = malloc(ast_len * sizeof(struct ins_with_offset));
     if (UNLIKELY(stack == NULL)) {
@@ -101,72 +125,83 @@ u6a_codegen(struct u6a_ast_node* ast_arr, uint32_t ast_len) {
         free(bc_buffer);
         return false;
     }
+    uint32_t* share;
+    if (UNLIKELY(!u6a_optimize_share(ast_arr, ast_len, &share))) {
+        free(bc_buffer);
+        free(stack);
+        return false;
+    }
+    // Subroutines are generated after the program, in the order they are first called
+    uint32_t* sub_offsets = NULL;
+    uint32_t* sub_queue = NULL;
+    uint32_t sub_queue_len = 0;
+    if (share) {
+        sub_offsets = malloc(2 * ast_len * sizeof(uint32_t));
+        if (UNLIKELY(sub_offsets == NULL)) {
+            u6a_err_bad_alloc(err_codegen, 2 * ast_len * sizeof(uint32_t));
+            free(bc_buffer);
+            free(stack);
+            free(share);
+            return false;
+        }
+        memset(sub_offsets, 0xFF, ast_len * sizeof(uint32_t));
+        sub_queue = sub_offsets + ast_len;
+    }
     uint32_t stack_top = UINT32_MAX;
-    for (uint32_t node_idx = 0; node_idx < ast_len; ++node_idx) {
-        struct u6a_ast_node* node = ast_arr + node_idx;
-        if (U6A_AN_FN(node) != u6a_tf_app) {
-            continue;
+    uint32_t features = 0;
+    uint32_t root_idx = 0;
+    uint32_t end_idx = ast_len;
+    for (uint32_t sub_idx = 0; ; root_idx = sub_queue[sub_idx++]) {
+        if (root_idx) {
+            sub_offsets[root_idx] = text_len;
+            end_idx = subtree_end(ast_arr, root_idx);
         }
-        struct u6a_ast_node* lchild = U6A_AN_LEFT(node);
-        struct u6a_ast_node* rchild = U6A_AN_RIGHT(node, ast_arr);
-        if (U6A_AN_FN(lchild) == u6a_tf_app) {
-            if (U6A_AN_FN(rchild) == u6a_tf_app) {
-                stack[++stack_top].ins.opcode = u6a_vo_sa;
-            } else {
-                stack[++stack_top].ins = (struct u6a_vm_ins) {
-                    .opcode = u6a_vo_app,
-                    .operand.fn.second = rchild->value
+        for (uint32_t node_idx = root_idx; node_idx < end_idx; ++node_idx) {
+            struct u6a_ast_node* node = ast_arr + node_idx;
+            if (U6A_AN_FN(node) != u6a_tf_app) {
+                features |= U6A_BC_FEATURE_OF(U6A_AN_FN(node));
+                continue;
+            }
+            if (share && share[node_idx] != UINT32_MAX && node_idx != root_idx) {
+                // Operand is the first occurrence of the subtree for now, which is replaced by its offset in the end
+                const uint32_t first_idx = share[node_idx];
+                if (sub_offsets[first_idx] == UINT32_MAX) {
+                    sub_offsets[first_idx] = 0;
+                    sub_queue[sub_queue_len++] = first_idx;
+                }
+                text_buffer[text_len++] = (struct u6a_vm_ins) {
+                    .opcode = u6a_vo_call,
+                    .operand.offset = first_idx
                 };
+                node_idx = subtree_end(ast_arr, node_idx) - 1;
+                goto pop_pending;
             }
-        } else {
-            if (U6A_AN_FN(rchild) == u6a_tf_app) {
-                if (U6A_AN_FN(lchild) == u6a_tf_d) {
-                    text_buffer[text_len].opcode = u6a_vo_del;
-                    stack[++stack_top] = (struct ins_with_offset) {
-                        .ins.opcode = u6a_vo_la,
-                        .offset = text_len++
-                    };
+            struct u6a_ast_node* lchild = U6A_AN_LEFT(node);
+            struct u6a_ast_node* rchild = U6A_AN_RIGHT(node, ast_arr);
+            if (U6A_AN_FN(lchild) == u6a_tf_app) {
+                if (U6A_AN_FN(rchild) == u6a_tf_app) {
+                    stack[++stack_top].ins.opcode = u6a_vo_sa;
                 } else {
                     stack[++stack_top].ins = (struct u6a_vm_ins) {
-                        .opcode = u6a_vo_app,
-                        .operand.fn.first = lchild->value
+                        .opcode = u6a_vo_app_ai,
+                        .operand.fn.second = rchild->value
                     };
                 }
             } else {
-                if (optimize_const && U6A_AN_FN(lchild) == u6a_tf_out) {
-                    uint32_t old_rodata_len = rodata_len;
-                    uint32_t old_stack_top = stack_top;
-                    rodata_buffer[rodata_len++] = U6A_AN_CH(lchild);
-                    while (stack_top < UINT32_MAX) {
-                        struct u6a_vm_ins peek_ins = stack[stack_top--].ins;
-                        struct u6a_token operand_first = peek_ins.operand.fn.first;
-                        struct u6a_token operand_second = peek_ins.operand.fn.second;
-                        if (peek_ins.opcode == u6a_vo_app && operand_first.fn == u6a_tf_out && !operand_second.fn) {
-                            rodata_buffer[rodata_len++] = operand_first.ch;
-                        } else {
-                            ++stack_top;
-                            break;
-                        }
-                    }
-                    // Ignore short strings, as they don't optimize much
-                    if (rodata_len - old_rodata_len < OPTIMIZE_STR_MIN_LEN) {
-                        rodata_len = old_rodata_len;
-                        stack_top = old_stack_top;
-                        goto no_optimize_str;
-                    } else {
-                        rodata_buffer[rodata_len++] = '\0';
-                        text_buffer[text_len++] = (struct u6a_vm_ins) {
-                            .opcode = u6a_vo_lc,
-                            .opcode_ex = u6a_vo_ex_print,
-                            .operand.offset = htonl(old_rodata_len)
+                if (U6A_AN_FN(rchild) == u6a_tf_app) {
+                    if (U6A_AN_FN(lchild) == u6a_tf_d) {
+                        text_buffer[text_len].opcode = u6a_vo_del;
+                        stack[++stack_top] = (struct ins_with_offset) {
+                            .ins.opcode = u6a_vo_la,
+                            .offset = text_len++
                         };
-                        text_buffer[text_len++] = (struct u6a_vm_ins) {
-                            .opcode = u6a_vo_app,
-                            .operand.fn.second = rchild->value
+                    } else {
+                        stack[++stack_top].ins = (struct u6a_vm_ins) {
+                            .opcode = u6a_vo_app_ia,
+                            .operand.fn.first = lchild->value
                         };
                     }
                 } else {
-                    no_optimize_str:
                     text_buffer[text_len++] = (struct u6a_vm_ins) {
                         .opcode = u6a_vo_app,
                         .operand.fn = {
@@ -174,41 +209,79 @@ u6a_codegen(struct u6a_ast_node* ast_arr, uint32_t ast_len) {
                             .second = rchild->value
                         }
                     };
-                }
-                while (stack_top < UINT32_MAX) {
-                    struct ins_with_offset* top_elem = stack + stack_top--;
-                    if (top_elem->ins.opcode == u6a_vo_sa) {
-                        text_buffer[text_len].opcode = u6a_vo_sa;
-                        stack[++stack_top] = (struct ins_with_offset) {
-                            .ins.opcode = u6a_vo_la,
-                            .offset = text_len++
-                        };
-                        break;
-                    } else {
-                        text_buffer[text_len++] = top_elem->ins;
-                        if (top_elem->ins.opcode == u6a_vo_la) {
-                            text_buffer[top_elem->offset].operand.offset = htonl(text_len);
+                    pop_pending:
+                    while (stack_top < UINT32_MAX) {
+                        struct ins_with_offset* top_elem = stack + stack_top--;
+                        if (top_elem->ins.opcode == u6a_vo_sa) {
+                            text_buffer[text_len].opcode = u6a_vo_sa;
+                            stack[++stack_top] = (struct ins_with_offset) {
+                                .ins.opcode = u6a_vo_la,
+                                .offset = text_len++
+                            };
+                            break;
+                        } else {
+                            text_buffer[text_len++] = top_elem->ins;
+                            if (top_elem->ins.opcode == u6a_vo_la) {
+                                text_buffer[top_elem->offset].operand.offset = text_len;
+                            }
                         }
                     }
                 }
             }
         }
+        if (root_idx) {
+            // Subroutine returns as `la` applies `j` pushed by `call`
+            text_buffer[text_len++].opcode = u6a_vo_la;
+        }
+        if (sub_idx == sub_queue_len) {
+            break;
+        }
     }
+    for (uint32_t offset = U6A_VM_TEXT_SUBST_LEN; offset < text_len; ++offset) {
+        if (text_buffer[offset].opcode == u6a_vo_call) {
+            text_buffer[offset].operand.offset = sub_offsets[text_buffer[offset].operand.offset];
+        }
+    }
+    free(stack);
+    free(share);
+    free(sub_offsets);
+    if (UNLIKELY(!u6a_optimize_text(text_buffer, &text_len, rodata_buffer, &rodata_len))) {
+        free(bc_buffer);
+        return false;
+    }
+    if (target != u6a_ct_bc) {
+        const bool written = u6a_codegen_c(output_stream, file_name, text_buffer, text_len, rodata_buffer, rodata_len,
+            features, target == u6a_ct_bundle);
+        free(bc_buffer);
+        if (written) {
+            u6a_info_verbose(info_codegen, "C code written, text: %" PRIu32 ", rodata: %" PRIu32 ", features: 0x%02"
+                PRIX32, text_len, rodata_len, features);
+        }
+        return written;
+    }
+    // Sections are page aligned within the file, so that they can be mapped into memory
+    const uint32_t header_end = prefix_len + sizeof(struct u6a_bc_header);
+    const uint32_t text_size = text_len * sizeof(struct u6a_vm_ins);
+    const uint32_t text_offset = U6A_ALIGN_UP(header_end, U6A_BC_SECTION_ALIGN);
+    const uint32_t rodata_offset = U6A_ALIGN_UP(text_offset + text_size, U6A_BC_SECTION_ALIGN);
+    const uint32_t text_padding = text_offset - header_end;
+    const uint32_t rodata_padding = rodata_offset - text_offset - text_size;
     uint32_t write_len;
-    if (UNLIKELY(!write_bc_header(output_stream, text_len, rodata_len))) {
+    if (UNLIKELY(!write_bc_header(output_stream, text_size, rodata_len, text_offset, rodata_offset, features))) {
         write_len = sizeof(struct u6a_bc_header);
         goto codegen_failed;
     }
+    WRITE_SECION(padding, sizeof(char), text_padding, output_stream);
     WRITE_SECION(text_buffer, sizeof(struct u6a_vm_ins), text_len, output_stream);
+    WRITE_SECION(padding, sizeof(char), rodata_padding, output_stream);
     WRITE_SECION(rodata_buffer, sizeof(char), rodata_len, output_stream);
     free(bc_buffer);
-    free(stack);
-    u6a_info_verbose(info_codegen, "completed, text: %" PRIu32 ", rodata: %" PRIu32, text_len, rodata_len);
+    u6a_info_verbose(info_codegen, "completed, text: %" PRIu32 ", rodata: %" PRIu32 ", features: 0x%02" PRIX32,
+        text_len, rodata_len, features);
     return true;
 
     codegen_failed:
     u6a_err_write_failed(err_codegen, write_len, file_name);
     free(bc_buffer);
-    free(stack);
     return false;
 }
@@ -26,8 +26,14 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+enum u6a_codegen_target {
+    u6a_ct_bc,                                        /* bytecode */
+    u6a_ct_c,                                         /* C code running the program natively */
+    u6a_ct_bundle                                     /* C code holding bytecode, to be linked into an executable */
+};
+
 void
-u6a_codegen_init(FILE* output_stream, const char* file_name, bool optimize_const);
+u6a_codegen_init(FILE* output_stream, const char* file_name, enum u6a_codegen_target target);
 
 bool
 u6a_write_prefix(const char* prefix_string);
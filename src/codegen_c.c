@@ -0,0 +1,369 @@
+/*
+ * codegen_c.c - Unlambda C code generator
+ * 
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "codegen_c.h"
+#include "logging.h"
+
+#include <string.h>
+#include <inttypes.h>
+
+// Each instruction is lowered into a labelled block of C code, as the JIT does into x86-64 code. Offsets known
+// at compile time become direct gotos, while others go through a switch over all instructions. Applications
+// other than the trivial ones call back into the runtime, which the program is linked against.
+//
+// Blocks are grouped into functions of a bounded number of instructions, as C compilers take time superlinear in
+// the size of a function to optimize it. Transfers out of a function return to a loop calling the one holding
+// the target.
+//
+// Definitions shared with the runtime come from the header installed along with it, which the output is checked
+// against, both when compiled and when run.
+
+#define WRITE_C(...)                                                       \
+    if (UNLIKELY(!write_line(snprintf(line, sizeof(line), __VA_ARGS__)))) { \
+        return false;                                                      \
+    }
+
+// Instructions lowered into one function. Builds for testing may lower it, so that small programs span
+// several functions.
+#ifdef U6A_CODEGEN_C_CHUNK_LEN
+#define CHUNK_LEN U6A_CODEGEN_C_CHUNK_LEN
+#else
+#define CHUNK_LEN 1024
+#endif
+// Characters of a string literal written on one line
+#define STR_LINE_LEN 64
+
+static FILE*       output_stream;
+static const char* file_name;
+static char        line[128];
+// Whether the function being written jumps to its error label
+static bool        fails;
+
+static const char* err_codegen = "codegen error";
+
+static const char prelude[] =
+    "#include <u6a_native.h>\n"
+    "\n"
+    "#define VAR(fn_, ch_, ref_) ( (struct u6a_vm_var_fn) { { (fn_), (ch_) }, 0, (ref_) } )\n"
+    "\n"
+    "// Applications of ``sXY continue at offset 0, as most transfers do, which RESTART jumps to\n"
+    "#define APPLY(func_, arg_, ins_)                                      \\\n"
+    "    func = (func_);                                                   \\\n"
+    "    ret = ops->apply[func.token.fn](func, (arg_), (ins_));            \\\n"
+    "    acc = ret.acc;                                                    \\\n"
+    "    if (ret.next != (ins_) + 1) {                                     \\\n"
+    "        if (ret.next == 0) {                                          \\\n"
+    "            RESTART;                                                  \\\n"
+    "        }                                                             \\\n"
+    "        goto transfer;                                                \\\n"
+    "    }\n"
+    "\n"
+    "typedef struct u6a_vm_jit_ret (*chunk_fn)(const struct u6a_vm_jit_ops* ops, struct u6a_vm_jit_ret ret);\n"
+    "\n";
+
+static bool
+write_line(int len) {
+    if (UNLIKELY(len < 0 || (size_t)len >= sizeof(line))) {
+        u6a_err_custom(err_codegen, "C code line too long");
+        return false;
+    }
+    if (UNLIKELY((size_t)len != fwrite(line, sizeof(char), len, output_stream))) {
+        u6a_err_write_failed(err_codegen, len, file_name);
+        return false;
+    }
+    return true;
+}
+
+static bool
+write_text(const struct u6a_vm_ins* text, uint32_t text_len) {
+    WRITE_C("static const struct u6a_vm_ins text[] = {\n");
+    for (uint32_t offset = 0; offset < text_len; ++offset) {
+        const struct u6a_vm_ins* ins = text + offset;
+        if (ins->opcode & U6A_VM_OP_APPLY) {
+            const struct u6a_token first = ins->operand.fn.first;
+            const struct u6a_token second = ins->operand.fn.second;
+            WRITE_C("    { 0x%02X, 0x%02X, 0, { .fn = { { 0x%02X, 0x%02X }, { 0x%02X, 0x%02X } } } },\n",
+                ins->opcode, ins->opcode_ex, first.fn, first.ch, second.fn, second.ch);
+        } else {
+            WRITE_C("    { 0x%02X, 0x%02X, 0, { .offset = %" PRIu32 " } },\n",
+                ins->opcode, ins->opcode_ex, ins->operand.offset);
+        }
+    }
+    WRITE_C("};\n\n");
+    return true;
+}
+
+// Strings are laid out as fields of a struct, which are aligned the same way as in rodata, while their
+// lengths are written in the byte order of the machine compiling the output.
+static bool
+write_rodata(const char* rodata, uint32_t rodata_len) {
+    if (rodata_len == 0) {
+        return true;
+    }
+    WRITE_C("static const struct {\n");
+    for (uint32_t offset = 0; offset < rodata_len; ) {
+        uint32_t str_len;
+        memcpy(&str_len, rodata + offset, sizeof(uint32_t));
+        WRITE_C("    uint32_t l%" PRIu32 "; char s%" PRIu32 "[%" PRIu32 "];\n", offset, offset, str_len);
+        offset = U6A_ALIGN_UP(offset + sizeof(uint32_t) + str_len, U6A_VM_RODATA_STR_ALIGN);
+    }
+    WRITE_C("} rodata = {\n");
+    for (uint32_t offset = 0; offset < rodata_len; ) {
+        uint32_t str_len;
+        memcpy(&str_len, rodata + offset, sizeof(uint32_t));
+        const char* str = rodata + offset + sizeof(uint32_t);
+        WRITE_C("    %" PRIu32 ", \"", str_len);
+        for (uint32_t idx = 0; idx < str_len; ++idx) {
+            const char ch = str[idx];
+            // Long strings are split into adjacent literals, which stay within limits of C compilers
+            if (idx != 0 && idx % STR_LINE_LEN == 0) {
+                WRITE_C("\"\n    \"");
+            }
+            // Octal escapes take no more than three digits, unlike hexadecimal ones
+            if (ch >= ' ' && ch <= '~' && ch != '"' && ch != '\\' && ch != '?') {
+                WRITE_C("%c", ch);
+            } else {
+                WRITE_C("\\%03o", (unsigned char)ch);
+            }
+        }
+        WRITE_C("\",\n");
+        offset = U6A_ALIGN_UP(offset + sizeof(uint32_t) + str_len, U6A_VM_RODATA_STR_ALIGN);
+    }
+    WRITE_C("};\n\n");
+    return true;
+}
+
+// Jumps to an instruction, which may be lowered into another function
+static bool
+write_goto(const char* indent, uint32_t target, uint32_t chunk_begin, uint32_t chunk_end) {
+    if (target >= chunk_begin && target < chunk_end) {
+        WRITE_C("%sgoto L%" PRIu32 ";\n", indent, target);
+    } else {
+        WRITE_C("%sret.next = %" PRIu32 ";\n", indent, target);
+        WRITE_C("%sgoto leave;\n", indent);
+    }
+    return true;
+}
+
+static bool
+write_ins(const struct u6a_vm_ins* ins, uint32_t offset, bool promises, uint32_t chunk_begin, uint32_t chunk_end) {
+    const struct u6a_token first = ins->operand.fn.first;
+    const struct u6a_token second = ins->operand.fn.second;
+    WRITE_C("L%" PRIu32 ":\n", offset);
+    switch (ins->opcode) {
+        case u6a_vo_app:
+            if (!U6A_VM_FN_IS_PRIM(second.fn)) {
+                WRITE_C("    APPLY(VAR(0x%02X, 0x%02X, 0), VAR(0x%02X, 0x%02X, 0), %" PRIu32 ");\n",
+                    first.fn, first.ch, second.fn, second.ch, offset);
+            } else if (first.fn == u6a_vf_i) {
+                WRITE_C("    acc = VAR(0x%02X, 0x%02X, 0);\n", second.fn, second.ch);
+            } else if (first.fn == u6a_vf_k) {
+                WRITE_C("    acc = VAR(0x%02X, 0, 0x%04" PRIX32 ");\n", u6a_vf_k1_imm, U6A_VM_IMM(second));
+            } else if (first.fn == u6a_vf_s) {
+                WRITE_C("    acc = VAR(0x%02X, 0, 0x%04" PRIX32 ");\n", u6a_vf_s1_imm, U6A_VM_IMM(second));
+            } else if (first.fn == u6a_vf_d) {
+                WRITE_C("    acc = VAR(0x%02X, 0, 0x%04" PRIX32 ");\n", u6a_vf_d1_c_imm, U6A_VM_IMM(second));
+            } else if (first.fn == u6a_vf_v) {
+                WRITE_C("    acc = VAR(0x%02X, 0, 0);\n", u6a_vf_v);
+            } else if (first.fn == u6a_vf_out) {
+                WRITE_C("    u6a_vm_output_putc(0x%02X);\n", first.ch);
+                WRITE_C("    acc = VAR(0x%02X, 0x%02X, 0);\n", second.fn, second.ch);
+            } else {
+                WRITE_C("    APPLY(VAR(0x%02X, 0x%02X, 0), VAR(0x%02X, 0x%02X, 0), %" PRIu32 ");\n",
+                    first.fn, first.ch, second.fn, second.ch, offset);
+            }
+            break;
+        case u6a_vo_app_ia:
+            if (first.fn == u6a_vf_i) {
+                // Leaves acc as is
+            } else if (first.fn == u6a_vf_out) {
+                WRITE_C("    u6a_vm_output_putc(0x%02X);\n", first.ch);
+            } else {
+                WRITE_C("    APPLY(VAR(0x%02X, 0x%02X, 0), acc, %" PRIu32 ");\n", first.fn, first.ch, offset);
+            }
+            break;
+        case u6a_vo_app_ai:
+            WRITE_C("    APPLY(acc, VAR(0x%02X, 0x%02X, 0), %" PRIu32 ");\n", second.fn, second.ch, offset);
+            break;
+        case u6a_vo_la:
+            WRITE_C("    if (!u6a_vm_stack_pop(&func)) {\n");
+            WRITE_C("        goto error;\n");
+            fails = true;
+            WRITE_C("    }\n");
+            WRITE_C("    APPLY(func, acc, %" PRIu32 ");\n", offset);
+            break;
+        case u6a_vo_sa:
+            if (promises) {
+                WRITE_C("    if (acc.token.fn == 0x%02X) {\n", u6a_vf_d);
+                WRITE_C("        acc = VAR(0x%02X, 0, %" PRIu32 ");\n", u6a_vf_d1_d, offset + 1);
+                if (UNLIKELY(!write_goto("        ", ins->operand.offset, chunk_begin, chunk_end))) {
+                    return false;
+                }
+                WRITE_C("    }\n");
+            }
+            WRITE_C("    if (!u6a_vm_stack_push1(acc)) {\n");
+            WRITE_C("        goto error;\n");
+            fails = true;
+            WRITE_C("    }\n");
+            break;
+        case u6a_vo_del:
+            WRITE_C("    acc = VAR(0x%02X, 0, %" PRIu32 ");\n", u6a_vf_d1_d, offset + 1);
+            if (UNLIKELY(!write_goto("    ", ins->operand.offset, chunk_begin, chunk_end))) {
+                return false;
+            }
+            break;
+        case u6a_vo_call:
+            WRITE_C("    if (!u6a_vm_stack_push1(VAR(0x%02X, 0, %" PRIu32 "))) {\n", u6a_vf_j, offset);
+            WRITE_C("        goto error;\n");
+            fails = true;
+            WRITE_C("    }\n");
+            if (UNLIKELY(!write_goto("    ", ins->operand.offset, chunk_begin, chunk_end))) {
+                return false;
+            }
+            break;
+        case u6a_vo_lc:
+            WRITE_C("    acc = VAR(0x%02X, 0, %" PRIu32 ");\n", u6a_vf_p, ins->operand.offset);
+            break;
+        case u6a_vo_xch:
+            if (promises) {
+                WRITE_C("    if (acc.token.fn == 0x%02X) {\n", u6a_vf_d);
+                WRITE_C("        ret = ops->delay_top(%" PRIu32 ");\n", offset);
+                WRITE_C("        acc = ret.acc;\n");
+                WRITE_C("        if (ret.next != %" PRIu32 ") {\n", offset + 1);
+                WRITE_C("            goto transfer;\n");
+                WRITE_C("        }\n");
+                WRITE_C("    } else if (!u6a_vm_stack_xch(&acc)) {\n");
+            } else {
+                WRITE_C("    if (!u6a_vm_stack_xch(&acc)) {\n");
+            }
+            WRITE_C("        goto error;\n");
+            fails = true;
+            WRITE_C("    }\n");
+            break;
+        default:
+            // Text comes from the bytecode generator, which never writes other instructions
+            U6A_NOT_REACHED();
+    }
+    return true;
+}
+
+static bool
+write_chunk(const struct u6a_vm_ins* text, uint32_t text_len, uint32_t begin, bool promises) {
+    const uint32_t end = text_len - begin > CHUNK_LEN ? begin + CHUNK_LEN : text_len;
+    WRITE_C("#undef RESTART\n");
+    WRITE_C("#define RESTART %s\n\n", begin == 0 ? "goto L0" : "goto leave");
+    WRITE_C("static struct u6a_vm_jit_ret\n");
+    WRITE_C("run_%" PRIu32 "(const struct u6a_vm_jit_ops* ops, struct u6a_vm_jit_ret ret) {\n", begin / CHUNK_LEN);
+    WRITE_C("    struct u6a_vm_var_fn acc = ret.acc, func = VAR(0, 0, 0);\n");
+    // Some functions apply nothing
+    WRITE_C("    (void)ops, (void)func;\n");
+    WRITE_C("    goto transfer;\n");
+    fails = false;
+    for (uint32_t offset = begin; offset < end; ++offset) {
+        if (UNLIKELY(!write_ins(text + offset, offset, promises, begin, end))) {
+            return false;
+        }
+    }
+    if (end == text_len) {
+        // Running past the end of text
+        WRITE_C("    goto error;\n");
+        fails = true;
+    } else {
+        WRITE_C("    ret.next = %" PRIu32 ";\n", end);
+        WRITE_C("    goto leave;\n");
+    }
+    WRITE_C("transfer:\n");
+    WRITE_C("    switch (ret.next) {\n");
+    for (uint32_t offset = begin; offset < end; ++offset) {
+        WRITE_C("        case %" PRIu32 ": goto L%" PRIu32 ";\n", offset, offset);
+    }
+    WRITE_C("        default: goto leave;\n");
+    WRITE_C("    }\n");
+    if (fails) {
+        WRITE_C("error:\n");
+        WRITE_C("    ret.next = U6A_VM_JIT_ERROR;\n");
+    }
+    WRITE_C("leave:\n");
+    WRITE_C("    ret.acc = acc;\n");
+    WRITE_C("    return ret;\n");
+    WRITE_C("}\n\n");
+    return true;
+}
+
+static bool
+write_run(const struct u6a_vm_ins* text, uint32_t text_len, uint32_t features) {
+    const bool promises = features & U6A_BC_FEATURE_D;
+    for (uint32_t begin = 0; begin < text_len; begin += CHUNK_LEN) {
+        if (UNLIKELY(!write_chunk(text, text_len, begin, promises))) {
+            return false;
+        }
+    }
+    WRITE_C("static const chunk_fn chunks[] = {\n");
+    for (uint32_t begin = 0; begin < text_len; begin += CHUNK_LEN) {
+        WRITE_C("    run_%" PRIu32 ",\n", begin / CHUNK_LEN);
+    }
+    WRITE_C("};\n\n");
+    // Sentinels, as well as any other offset out of text, are handed over to the runtime
+    WRITE_C("static struct u6a_vm_jit_ret\n");
+    WRITE_C("run(const struct u6a_vm_jit_ops* ops, uint32_t offset) {\n");
+    WRITE_C("    struct u6a_vm_jit_ret ret = { VAR(0, 0, 0), offset };\n");
+    WRITE_C("    while (ret.next < %" PRIu32 ") {\n", text_len);
+    WRITE_C("        ret = chunks[ret.next / %d](ops, ret);\n", CHUNK_LEN);
+    WRITE_C("    }\n");
+    WRITE_C("    return ret;\n");
+    WRITE_C("}\n\n");
+    return true;
+}
+
+bool
+u6a_codegen_c(FILE* output_stream_, const char* file_name_, const struct u6a_vm_ins* text, uint32_t text_len,
+              const char* rodata, uint32_t rodata_len, uint32_t features, bool interpret) {
+    output_stream = output_stream_;
+    file_name = file_name_;
+    WRITE_C("/* Generated by u6ac %d.%d.%d, to be linked against libu6a */\n\n",
+        U6A_VER_MAJOR, U6A_VER_MINOR, U6A_VER_PATCH);
+    if (UNLIKELY(sizeof(prelude) - 1 != fwrite(prelude, sizeof(char), sizeof(prelude) - 1, output_stream))) {
+        u6a_err_write_failed(err_codegen, sizeof(prelude) - 1, file_name);
+        return false;
+    }
+    WRITE_C("#if U6A_NATIVE_REVISION != %d\n", U6A_NATIVE_REVISION);
+    WRITE_C("#error \"u6a_native.h does not match u6ac %d.%d.%d\"\n",
+        U6A_VER_MAJOR, U6A_VER_MINOR, U6A_VER_PATCH);
+    WRITE_C("#endif\n\n");
+    if (UNLIKELY(!write_text(text, text_len) || !write_rodata(rodata, rodata_len))) {
+        return false;
+    }
+    if (!interpret && UNLIKELY(!write_run(text, text_len, features))) {
+        return false;
+    }
+    WRITE_C("static const struct u6a_runtime_native native = {\n");
+    WRITE_C("    .layout = U6A_NATIVE_LAYOUT,\n");
+    WRITE_C("    .ver_major = 0x%02X, .ver_minor = 0x%02X, .features = 0x%02" PRIX32 ",\n",
+        U6A_VER_MAJOR, U6A_VER_MINOR, features);
+    WRITE_C("    .text = text, .text_len = %" PRIu32 ",\n", text_len);
+    WRITE_C("    .rodata = %s, .rodata_len = %" PRIu32 ",\n", rodata_len ? "(const char*)&rodata" : "NULL",
+        rodata_len);
+    WRITE_C("    .run = %s\n", interpret ? "NULL" : "run");
+    WRITE_C("};\n\n");
+    WRITE_C("int\n");
+    WRITE_C("main(int argc, char** argv) {\n");
+    WRITE_C("    return u6a_main(argc, argv, &native);\n");
+    WRITE_C("}\n");
+    return true;
+}
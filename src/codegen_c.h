@@ -0,0 +1,36 @@
+/*
+ * codegen_c.h - Unlambda C code generator definitions
+ * 
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef U6A_CODEGEN_C_H_
+#define U6A_CODEGEN_C_H_
+
+#include "common.h"
+#include "vm_defs.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Writes a C translation unit which runs the given program when linked against the runtime library. With
+// `interpret`, text is left to the interpreter instead of being compiled.
+bool
+u6a_codegen_c(FILE* output_stream, const char* file_name, const struct u6a_vm_ins* text, uint32_t text_len,
+              const char* rodata, uint32_t rodata_len, uint32_t features, bool interpret);
+
+#endif
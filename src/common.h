@@ -29,12 +29,16 @@
 #define UNLIKELY(expr)    __builtin_expect(!!(expr), 0)
 #define U6A_COLD          __attribute__((cold))
 #define U6A_HOT           __attribute__((hot))
+#define U6A_ALWAYS_INLINE __attribute__((always_inline)) inline
+#define U6A_UNUSED        __attribute__((unused))
 #define U6A_NOT_REACHED() __builtin_unreachable()
 #else
 #define LIKELY(expr)      (expr)
 #define UNLIKELY(expr)    (expr)
 #define U6A_COLD
 #define U6A_HOT
+#define U6A_ALWAYS_INLINE inline
+#define U6A_UNUSED
 #define U6A_NOT_REACHED()
 #endif
 
@@ -46,7 +50,7 @@
 
 #define U6A_MAGIC     0xDC  /* Latin 'U' with diaeresis */
 #define U6A_VER_MAJOR 0x00
-#define U6A_VER_MINOR 0x00
+#define U6A_VER_MINOR 0x01
 #define U6A_VER_PATCH 0x00
 
 #endif
@@ -21,6 +21,7 @@
 #define U6A_DEFS_H_
 
 #include "common.h"
+#include "u6a_native.h"
 
 #include <stdint.h>
 #include <stddef.h>
@@ -38,11 +39,6 @@ enum u6a_token_fn {
     u6a_tf_app = U6A_TOKEN_FN_APP    /* ` */
 };
 
-struct u6a_token {
-    uint8_t fn;
-    uint8_t ch;
-};
-
 #define U6A_TOKEN(fn_, ch_) (struct u6a_token) { .fn = (fn_), .ch = (ch_) }
 #define U6A_TOKEN_INIT_LEN  ( 4 * 1024 )
 #define U6A_TOKEN_MAX_LEN   ( U6A_TOKEN_INIT_LEN * 1024 )
@@ -66,12 +62,38 @@ struct u6a_bc_header {
         uint8_t  prog_header_size;   
     } file;
     struct {
+        uint32_t byte_order;         /* U6A_BC_BYTE_ORDER, in the byte order of all program header and section data */
         uint32_t text_size;          /* length of text segment (Bytes) */
         uint32_t rodata_size;        /* length of rodata segment (Bytes) */
+        uint32_t text_offset;        /* offset of text segment from the beginning of file, prefix included */
+        uint32_t rodata_offset;      /* offset of rodata segment from the beginning of file, prefix included */
+        uint32_t features;           /* U6A_BC_FEATURE_*, functions used by the program */
     } prog;
 };
 
-#define U6A_BC_FILE_HEADER_SIZE sizeof(((struct u6a_bc_header*)NULL)->file)
-#define U6A_BC_PROG_HEADER_SIZE sizeof(((struct u6a_bc_header*)NULL)->prog)
+#define U6A_BC_FILE_HEADER_SIZE     sizeof(((struct u6a_bc_header*)NULL)->file)
+#define U6A_BC_PROG_HEADER_SIZE     sizeof(((struct u6a_bc_header*)NULL)->prog)
+#define U6A_BC_PROG_HEADER_MIN_SIZE \
+    ( offsetof(struct u6a_bc_header, prog.features) - offsetof(struct u6a_bc_header, prog) )
+
+// Runtime may be specialized for programs which do without some of the functions
+#define U6A_BC_FEATURE_C      ( 1 << 0 )  /* c  */
+#define U6A_BC_FEATURE_D      ( 1 << 1 )  /* d  */
+#define U6A_BC_FEATURE_IN     ( 1 << 2 )  /* @  */
+#define U6A_BC_FEATURE_CMP    ( 1 << 3 )  /* ?X */
+#define U6A_BC_FEATURE_PIPE   ( 1 << 4 )  /* |  */
+#define U6A_BC_FEATURES_ALL     UINT32_MAX  /* assumed for bytecode files without the feature mask */
+
+#define U6A_BC_FEATURE_OF(fn_)                          \
+    ( (fn_) == u6a_tf_c    ? U6A_BC_FEATURE_C    :      \
+      (fn_) == u6a_tf_d    ? U6A_BC_FEATURE_D    :      \
+      (fn_) == u6a_tf_in   ? U6A_BC_FEATURE_IN   :      \
+      (fn_) == u6a_tf_cmp  ? U6A_BC_FEATURE_CMP  :      \
+      (fn_) == u6a_tf_pipe ? U6A_BC_FEATURE_PIPE : 0 )
+
+#define U6A_BC_BYTE_ORDER       0x01020304
+#define U6A_BC_SECTION_ALIGN  ( 4 * 1024 )
+
+#define U6A_ALIGN_UP(val, align) ( ((val) + (align) - 1) / (align) * (align) )
 
 #endif
@@ -29,6 +29,7 @@
 
 const char* prog_name;
 bool verbose = false;
+bool verbose_to_stderr = false;
 
 void
 u6a_logging_init(const char* prog_name_) {
@@ -40,6 +41,11 @@ u6a_logging_verbose(bool verbose_) {
     verbose = verbose_;
 }
 
+void
+u6a_logging_verbose_to_stderr(bool to_stderr) {
+    verbose_to_stderr = to_stderr;
+}
+
 U6A_COLD void
 u6a_err_bad_alloc(const char* stage, size_t size) {
     fprintf(stderr, "%s: [%s] allocation failed - trying to allocate %zu bytes.\n", prog_name, stage, size);
@@ -107,6 +113,11 @@ u6a_err_invalid_uint(const char* stage, const char* str) {
     fprintf(stderr, "%s: [%s] \"%s\" is not a valid unsigned integer.\n", prog_name, stage, str);
 }
 
+U6A_COLD void
+u6a_err_invalid_option_arg(const char* stage, const char* option, const char* str) {
+    fprintf(stderr, "%s: [%s] \"%s\" is not a valid argument for option --%s.\n", prog_name, stage, str, option);
+}
+
 U6A_COLD void
 u6a_err_uint_not_in_range(const char* stage, uint32_t min_val, uint32_t max_val, uint32_t got) {
     fprintf(stderr, "%s: [%s] Integer out of range - [%" PRIu32 ", %" PRIu32 "] expected, %" PRIu32 " given.",
@@ -126,7 +137,7 @@ u6a_err_bad_bc_ver(const char* stage, const char* filename, int ver_major, int v
 
 U6A_COLD void
 u6a_err_vm_pool_oom(const char* stage) {
-    fprintf(stderr, "%s: [%s] VM object pool memory exhausted.\n", stage, prog_name);
+    fprintf(stderr, "%s: [%s] VM object pool memory exhausted.\n", prog_name, stage);
 }
 
 U6A_COLD void
@@ -149,7 +160,7 @@ u6a_info_verbose_(const char* format, ...) {
     if (verbose) {
         va_list args;
         va_start(args, format);
-        vprintf(format, args);
+        vfprintf(verbose_to_stderr ? stderr : stdout, format, args);
         va_end(args);
     }
 }
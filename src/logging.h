@@ -32,6 +32,9 @@ u6a_logging_init(const char* prog_name);
 void
 u6a_logging_verbose(bool verbose);
 
+void
+u6a_logging_verbose_to_stderr(bool to_stderr);
+
 void
 u6a_err_bad_alloc(const char* stage, size_t size);
 
@@ -68,6 +71,9 @@ u6a_err_stack_underflow(const char* stage);
 void
 u6a_err_invalid_uint(const char* stage, const char* str);
 
+void
+u6a_err_invalid_option_arg(const char* stage, const char* option, const char* str);
+
 void
 u6a_err_uint_not_in_range(const char* stage, uint32_t min_val, uint32_t max_val, uint32_t got);
 
@@ -0,0 +1,596 @@
+/*
+ * optimizer.c - Unlambda compile-time optimizer
+ * 
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "optimizer.h"
+#include "logging.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#define OPTIMIZE_STR_MIN_LEN 0x04
+#define OPTIMIZE_MAX_ROUNDS  8
+// Subtrees smaller than this are not worth a subroutine, which takes a `call` and a `la` to apply
+#define OPTIMIZE_SHARE_MIN_SIZE 16
+// Applications of s rewritten in one run of the combinators pass, per this many AST nodes
+#define OPTIMIZE_S_FUEL_DIV  4
+
+#define AN_IS_APP(node) ( U6A_AN_FN(node) == u6a_tf_app )
+#define INS_JUMPS(ins)  ( (ins)->opcode == u6a_vo_sa || (ins)->opcode == u6a_vo_del || (ins)->opcode == u6a_vo_call )
+
+// Rewrites a node into one of its descendants, or returns the node itself if the pass does not apply
+typedef const struct u6a_ast_node* (*ast_rewrite)(const struct u6a_ast_node* ast_arr, const struct u6a_ast_node* node);
+
+// Rewrites the AST as a whole, which never grows
+typedef bool (*ast_transform)(struct u6a_ast_node* ast_arr, uint32_t* ast_len, uint64_t* rewrites);
+
+// Maps nodes in place of which a subroutine is called to the first occurrence of the subtree
+typedef bool (*ast_share)(const struct u6a_ast_node* ast_arr, uint32_t ast_len, uint32_t* share, uint32_t* share_len,
+                          uint64_t* rewrites);
+
+// Rewrites text as a whole, counting rewrites made
+typedef bool (*text_rewrite)(struct u6a_vm_ins* text, uint32_t* text_len, char* rodata, uint32_t* rodata_len,
+                             uint64_t* rewrites);
+
+struct pass {
+    const char*   name;
+    uint32_t      min_level;     /* lowest optimization level the pass is enabled on */
+    ast_rewrite   rewrite_ast;   /* one of rewrite_ast, transform_ast, share_ast and rewrite_text is given */
+    ast_transform transform_ast;
+    ast_share     share_ast;
+    text_rewrite  rewrite_text;
+    int           override;      /* 1 if enabled by name, -1 if disabled by name, otherwise 0 */
+    bool          enabled;
+    uint64_t      rewrites;
+    uint64_t      nsec;
+    uint32_t      len_before;    /* AST nodes or instructions before the first run of the pass */
+    uint32_t      len_after;     /* and after the last run */
+};
+
+// Term of the combinators pass, which may be shared by terms built from it
+struct term {
+    struct u6a_token value;
+    uint8_t          flags;
+    uint32_t         left;
+    uint32_t         right;
+};
+
+// Made of s, k, i and v only, thus evaluates without effect if at all
+#define TERM_PURE  0x01
+// Pure, and evaluates without applying functions other than s, k, i, v and their partial applications
+#define TERM_VALUE 0x02
+
+#define PASS_ON_AST(pass) ( (pass)->rewrite_ast != NULL || (pass)->transform_ast != NULL )
+
+// Subtrees with the same class are identical
+struct share_class {
+    uint32_t left;              /* classes of children, or UINT32_MAX and the token of a leaf */
+    uint32_t right;
+    uint32_t size;
+    uint32_t refs;              /* occurrences in code generated, where shared subtrees are generated once */
+    uint32_t first;             /* first occurrence in pre-order */
+};
+
+struct ast_work {
+    uint32_t src;               /* node to be copied */
+    uint32_t patch;             /* copied left sibling to point to the copy, or UINT32_MAX */
+};
+
+static uint32_t level;
+
+static const char* err_optimize = "optimize error";
+static const char* info_optimize = "optimize";
+
+// ``iX -> X
+static const struct u6a_ast_node*
+rewrite_identity(const struct u6a_ast_node* ast_arr, const struct u6a_ast_node* node) {
+    if (AN_IS_APP(node) && U6A_AN_FN(U6A_AN_LEFT(node)) == u6a_tf_i) {
+        return U6A_AN_RIGHT(node, ast_arr);
+    }
+    return node;
+}
+
+// ```eXY -> `eX, as the program exits before Y is evaluated
+static const struct u6a_ast_node*
+rewrite_exit(const struct u6a_ast_node* ast_arr, const struct u6a_ast_node* node) {
+    (void) ast_arr;
+    if (AN_IS_APP(node) && AN_IS_APP(U6A_AN_LEFT(node)) && U6A_AN_FN(U6A_AN_LEFT(U6A_AN_LEFT(node))) == u6a_tf_e) {
+        return U6A_AN_LEFT(node);
+    }
+    return node;
+}
+
+// `vF -> v, where F is not an application, thus evaluates without effect
+static const struct u6a_ast_node*
+rewrite_void(const struct u6a_ast_node* ast_arr, const struct u6a_ast_node* node) {
+    if (AN_IS_APP(node) && U6A_AN_FN(U6A_AN_LEFT(node)) == u6a_tf_v && !AN_IS_APP(U6A_AN_RIGHT(node, ast_arr))) {
+        return U6A_AN_LEFT(node);
+    }
+    return node;
+}
+
+// `.X1`.X2...`.XnY -> `<print X1X2...Xn>Y, for strings long enough to be worth it
+static bool
+rewrite_strings(struct u6a_vm_ins* text, uint32_t* text_len, char* rodata, uint32_t* rodata_len,
+                uint64_t* rewrites) {
+    const uint32_t len = *text_len;
+    bool* targets = calloc(len, sizeof(bool));
+    uint32_t* new_offsets = malloc(len * sizeof(uint32_t));
+    if (UNLIKELY(targets == NULL || new_offsets == NULL)) {
+        u6a_err_bad_alloc(err_optimize, len * sizeof(uint32_t));
+        free(targets);
+        free(new_offsets);
+        return false;
+    }
+    // Strings are not folded across instructions jumped to
+    for (uint32_t offset = U6A_VM_TEXT_SUBST_LEN; offset < len; ++offset) {
+        if (INS_JUMPS(text + offset)) {
+            targets[text[offset].operand.offset] = true;
+        }
+    }
+    for (uint32_t offset = 0; offset < U6A_VM_TEXT_SUBST_LEN; ++offset) {
+        new_offsets[offset] = offset;
+    }
+    uint32_t new_len = U6A_VM_TEXT_SUBST_LEN;
+    for (uint32_t offset = U6A_VM_TEXT_SUBST_LEN; offset < len; ) {
+        const struct u6a_vm_ins ins = text[offset];
+        uint32_t str_len = 1;
+        if (ins.opcode == u6a_vo_app && ins.operand.fn.first.fn == u6a_tf_out) {
+            while (offset + str_len < len && !targets[offset + str_len]) {
+                const struct u6a_vm_ins* next = text + offset + str_len;
+                if (next->opcode != u6a_vo_app_ia || next->operand.fn.first.fn != u6a_tf_out) {
+                    break;
+                }
+                ++str_len;
+            }
+        }
+        if (str_len < OPTIMIZE_STR_MIN_LEN) {
+            new_offsets[offset++] = new_len;
+            text[new_len++] = ins;
+            continue;
+        }
+        const uint32_t str_offset = U6A_ALIGN_UP(*rodata_len, U6A_VM_RODATA_STR_ALIGN);
+        char* str = rodata + str_offset + sizeof(uint32_t);
+        memset(rodata + *rodata_len, 0, str_offset - *rodata_len);
+        memcpy(rodata + str_offset, &str_len, sizeof(uint32_t));
+        for (uint32_t idx = 0; idx < str_len; ++idx) {
+            str[idx] = text[offset + idx].operand.fn.first.ch;
+            new_offsets[offset + idx] = new_len;
+        }
+        *rodata_len = str_offset + sizeof(uint32_t) + str_len;
+        text[new_len++] = (struct u6a_vm_ins) {
+            .opcode = u6a_vo_lc,
+            .opcode_ex = u6a_vo_ex_print,
+            .operand.offset = str_offset
+        };
+        text[new_len++] = (struct u6a_vm_ins) {
+            .opcode = u6a_vo_app_ai,
+            .operand.fn.second = ins.operand.fn.second
+        };
+        offset += str_len;
+        ++*rewrites;
+    }
+    for (uint32_t offset = U6A_VM_TEXT_SUBST_LEN; offset < new_len; ++offset) {
+        if (INS_JUMPS(text + offset)) {
+            text[offset].operand.offset = new_offsets[text[offset].operand.offset];
+        }
+    }
+    *text_len = new_len;
+    free(targets);
+    free(new_offsets);
+    return true;
+}
+
+static inline bool
+fn_is_pure(uint8_t fn) {
+    return fn == u6a_tf_s || fn == u6a_tf_k || fn == u6a_tf_i || fn == u6a_tf_v;
+}
+
+static inline uint8_t
+term_flags(const struct term* terms, const struct term* term) {
+    if (term->value.fn != u6a_tf_app) {
+        return fn_is_pure(term->value.fn) ? TERM_PURE | TERM_VALUE : 0;
+    }
+    const struct term* left = terms + term->left;
+    const struct term* right = terms + term->right;
+    if (!(left->flags & right->flags & TERM_PURE)) {
+        return 0;
+    }
+    // Evaluating `FX applies F to X, which never takes more than a step if F is one of s, k, i, v, `sY and `kY
+    if (!(left->flags & right->flags & TERM_VALUE)) {
+        return TERM_PURE;
+    }
+    if (left->value.fn != u6a_tf_app) {
+        return TERM_PURE | TERM_VALUE;
+    }
+    const uint8_t left_fn = terms[left->left].value.fn;
+    return left_fn == u6a_tf_s || left_fn == u6a_tf_k ? TERM_PURE | TERM_VALUE : TERM_PURE;
+}
+
+static inline uint32_t
+term_app(struct term* terms, uint32_t* terms_len, uint32_t left, uint32_t right) {
+    struct term* term = terms + *terms_len;
+    *term = (struct term) { .value = U6A_TOKEN(u6a_tf_app, 0), .left = left, .right = right };
+    term->flags = term_flags(terms, term);
+    return (*terms_len)++;
+}
+
+// Rewrites a term once, or returns the term itself if no rule applies. Rules only drop evaluation of values, or
+// reduce applications of pure functions which would be done by the VM anyway, so that the rewritten term evaluates
+// the same, even if delayed by d as a promise.
+static uint32_t
+reduce_term(struct term* terms, uint32_t* terms_len, uint32_t idx, uint32_t* s_fuel) {
+    const struct term* term = terms + idx;
+    if (term->value.fn != u6a_tf_app) {
+        return idx;
+    }
+    const struct term* left = terms + term->left;
+    const struct term* right = terms + term->right;
+    // Identity and void passes have run before, but the rules below make new applications of i and v
+    // (e.g. ```sikZ -> ``iZ`kZ), which are reduced as soon as the rewritten term is visited
+    if (left->value.fn == u6a_tf_i) {
+        // `iX -> X
+        return term->right;
+    }
+    if (left->value.fn == u6a_tf_v && (right->flags & TERM_VALUE)) {
+        // `vX -> v
+        return term->left;
+    }
+    if (left->value.fn != u6a_tf_app) {
+        return idx;
+    }
+    const struct term* left_left = terms + left->left;
+    if (left_left->value.fn == u6a_tf_k && (right->flags & TERM_VALUE)) {
+        // ``kXY -> X
+        return left->right;
+    }
+    if (left_left->value.fn == u6a_tf_s && right->value.fn == u6a_tf_i) {
+        // ``s`kXi -> X, where X is pure thus never evaluates to d
+        const struct term* left_right = terms + left->right;
+        if (left_right->value.fn == u6a_tf_app && terms[left_right->left].value.fn == u6a_tf_k
+            && (terms[left_right->right].flags & TERM_PURE)) {
+            return left_right->right;
+        }
+    }
+    if (left_left->value.fn == u6a_tf_app && terms[left_left->left].value.fn == u6a_tf_s && *s_fuel
+        && right->value.fn != u6a_tf_app && (right->flags & TERM_VALUE)
+        && (terms[left_left->right].flags & terms[left->right].flags & TERM_VALUE)) {
+        // ```sXYZ -> ``XZ`YZ, where Z is duplicated, thus only done if it takes one node
+        const uint32_t x = left_left->right, y = left->right, z = term->right;
+        --*s_fuel;
+        const uint32_t xz = term_app(terms, terms_len, x, z);
+        const uint32_t yz = term_app(terms, terms_len, y, z);
+        return term_app(terms, terms_len, xz, yz);
+    }
+    return idx;
+}
+
+// Reduces pure subterms by combinator rules, rewriting the tree from the root
+static bool
+transform_combinators(struct u6a_ast_node* ast_arr, uint32_t* ast_len, uint64_t* rewrites) {
+    const uint32_t len = *ast_len;
+    uint32_t s_fuel = len / OPTIMIZE_S_FUEL_DIV;
+    // Each rewrite of s builds three applications
+    const uint32_t terms_size = (len + 3 * s_fuel) * sizeof(struct term);
+    struct term* terms = malloc(terms_size);
+    struct ast_work* work = malloc((len + 1) * sizeof(struct ast_work));
+    if (UNLIKELY(terms == NULL || work == NULL)) {
+        u6a_err_bad_alloc(err_optimize, terms_size);
+        free(terms);
+        free(work);
+        return false;
+    }
+    // Children come after their parent in pre-order, thus flags are known when visited backwards
+    for (uint32_t idx = len; idx-- > 0; ) {
+        const struct u6a_ast_node* node = ast_arr + idx;
+        struct term* term = terms + idx;
+        *term = (struct term) { .value = node->value };
+        if (AN_IS_APP(node)) {
+            term->left = idx + 1;
+            term->right = U6A_AN_RIGHT(node, ast_arr) - ast_arr;
+        }
+        term->flags = term_flags(terms, term);
+    }
+    uint32_t terms_len = len;
+    // No rule grows the tree, so that it is written in place: ```sXYZ -> ``XZ`YZ keeps the node count, as Z is
+    // a single node, and every other rule drops nodes
+    uint32_t dest_len = 0;
+    uint32_t work_top = 0;
+    work[work_top++] = (struct ast_work) { .src = 0, .patch = UINT32_MAX };
+    while (work_top) {
+        const struct ast_work item = work[--work_top];
+        uint32_t idx = item.src;
+        for (uint32_t next; (next = reduce_term(terms, &terms_len, idx, &s_fuel)) != idx; idx = next) {
+            ++*rewrites;
+        }
+        const struct term* term = terms + idx;
+        if (item.patch != UINT32_MAX) {
+            ast_arr[item.patch].sibling = dest_len;
+        }
+        ast_arr[dest_len] = (struct u6a_ast_node) { .value = term->value };
+        if (term->value.fn == u6a_tf_app) {
+            work[work_top++] = (struct ast_work) { .src = term->right, .patch = dest_len + 1 };
+            work[work_top++] = (struct ast_work) { .src = term->left, .patch = UINT32_MAX };
+        }
+        ++dest_len;
+    }
+    *ast_len = dest_len;
+    free(terms);
+    free(work);
+    return true;
+}
+
+static inline uint32_t
+share_hash(uint32_t left, uint32_t right) {
+    uint32_t hash = left * UINT32_C(0x9E3779B1) ^ right * UINT32_C(0x85EBCA77);
+    return hash ^ hash >> 15;
+}
+
+// Hash-conses the AST into a DAG, then decides which of the subtrees are shared by reference counting the DAG from
+// the root, as code of a shared subtree is generated only once, along with the subtrees within it.
+static bool
+share_subtrees(const struct u6a_ast_node* ast_arr, uint32_t ast_len, uint32_t* share, uint32_t* share_len,
+               uint64_t* rewrites) {
+    uint32_t table_size = 1;
+    while (table_size < 2 * ast_len) {
+        table_size <<= 1;
+    }
+    struct share_class* classes = malloc(ast_len * sizeof(struct share_class));
+    uint32_t* table = calloc(table_size, sizeof(uint32_t));
+    if (UNLIKELY(classes == NULL || table == NULL)) {
+        u6a_err_bad_alloc(err_optimize, ast_len * sizeof(struct share_class));
+        free(classes);
+        free(table);
+        return false;
+    }
+    // Classes of children are found before their parent's, thus have lower numbers
+    uint32_t classes_len = 0;
+    for (uint32_t idx = ast_len; idx-- > 0; ) {
+        const struct u6a_ast_node* node = ast_arr + idx;
+        uint32_t left, right, size;
+        if (AN_IS_APP(node)) {
+            left = share[idx + 1];
+            right = share[U6A_AN_RIGHT(node, ast_arr) - ast_arr];
+            size = 1 + classes[left].size + classes[right].size;
+        } else {
+            left = UINT32_MAX;
+            right = U6A_AN_FN(node) | U6A_AN_CH(node) << 8;
+            size = 1;
+        }
+        uint32_t slot = share_hash(left, right) & (table_size - 1);
+        while (table[slot] && (classes[table[slot] - 1].left != left || classes[table[slot] - 1].right != right)) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (!table[slot]) {
+            classes[classes_len] = (struct share_class) { .left = left, .right = right, .size = size };
+            table[slot] = ++classes_len;
+        }
+        const uint32_t class = table[slot] - 1;
+        classes[class].first = idx;
+        share[idx] = class;
+    }
+    free(table);
+    classes[share[0]].refs = 1;
+    uint32_t len = 0;
+    for (uint32_t class = classes_len; class-- > 0; ) {
+        struct share_class* current = classes + class;
+        const bool shared = current->refs > 1 && current->size >= OPTIMIZE_SHARE_MIN_SIZE;
+        const uint32_t generated = shared ? 1 : current->refs;
+        if (shared) {
+            *rewrites += current->refs;
+            len += current->refs;
+        } else {
+            current->first = UINT32_MAX;
+        }
+        len += generated;
+        if (current->left != UINT32_MAX) {
+            classes[current->left].refs += generated;
+            classes[current->right].refs += generated;
+        }
+    }
+    for (uint32_t idx = 0; idx < ast_len; ++idx) {
+        share[idx] = classes[share[idx]].first;
+    }
+    *share_len = len;
+    free(classes);
+    return true;
+}
+
+static struct pass passes[] = {
+    { .name = "identity",    .min_level = 2, .rewrite_ast   = rewrite_identity      },
+    { .name = "exit",        .min_level = 2, .rewrite_ast   = rewrite_exit          },
+    { .name = "void",        .min_level = 2, .rewrite_ast   = rewrite_void          },
+    { .name = "combinators", .min_level = 2, .transform_ast = transform_combinators },
+    { .name = "share",       .min_level = 2, .share_ast     = share_subtrees        },
+    { .name = "strings",     .min_level = 1, .rewrite_text  = rewrite_strings       }
+};
+
+#define PASSES_LEN ( sizeof(passes) / sizeof(struct pass) )
+
+static inline uint64_t
+elapsed_nsec(const struct timespec* begin) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin->tv_sec) * UINT64_C(1000000000) + end.tv_nsec - begin->tv_nsec;
+}
+
+// Copies the AST in pre-order, with each node rewritten by the pass before its children are visited
+static uint32_t
+copy_ast(const struct u6a_ast_node* src, struct u6a_ast_node* dest, struct ast_work* work, ast_rewrite rewrite,
+         uint64_t* rewrites) {
+    uint32_t dest_len = 0;
+    uint32_t work_top = 0;
+    work[work_top++] = (struct ast_work) { .src = 0, .patch = UINT32_MAX };
+    while (work_top) {
+        const struct ast_work item = work[--work_top];
+        const struct u6a_ast_node* node = src + item.src;
+        for (const struct u6a_ast_node* next; (next = rewrite(src, node)) != node; node = next) {
+            ++*rewrites;
+        }
+        if (item.patch != UINT32_MAX) {
+            dest[item.patch].sibling = dest_len;
+        }
+        dest[dest_len] = (struct u6a_ast_node) { .value = node->value };
+        if (AN_IS_APP(node)) {
+            work[work_top++] = (struct ast_work) { .src = U6A_AN_RIGHT(node, src) - src, .patch = dest_len + 1 };
+            work[work_top++] = (struct ast_work) { .src = U6A_AN_LEFT(node) - src, .patch = UINT32_MAX };
+        }
+        ++dest_len;
+    }
+    return dest_len;
+}
+
+static void
+print_stats(const struct pass* pass) {
+    u6a_info_verbose(info_optimize, "pass %s: %" PRIu64 " rewrites, %s %" PRIu32 " -> %" PRIu32 ", %" PRIu64 " us",
+        pass->name, pass->rewrites, pass->rewrite_text ? "instructions" : "nodes", pass->len_before,
+        pass->len_after, pass->nsec / 1000);
+}
+
+bool
+u6a_optimize_set_pass(const char* name, bool enabled) {
+    for (uint32_t idx = 0; idx < PASSES_LEN; ++idx) {
+        if (strcmp(passes[idx].name, name) == 0) {
+            passes[idx].override = enabled ? 1 : -1;
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+u6a_optimize_init(uint32_t level_) {
+    level = level_;
+    for (uint32_t idx = 0; idx < PASSES_LEN; ++idx) {
+        struct pass* pass = passes + idx;
+        pass->enabled = pass->override ? pass->override > 0 : level >= pass->min_level;
+    }
+}
+
+bool
+u6a_optimize_ast(struct u6a_ast_node* ast_arr, uint32_t* ast_len) {
+    bool any_enabled = false;
+    for (uint32_t idx = 0; idx < PASSES_LEN; ++idx) {
+        any_enabled |= passes[idx].enabled && PASS_ON_AST(passes + idx);
+    }
+    if (!any_enabled) {
+        return true;
+    }
+    struct u6a_ast_node* buffer = malloc(*ast_len * sizeof(struct u6a_ast_node));
+    struct ast_work* work = malloc((*ast_len + 1) * sizeof(struct ast_work));
+    if (UNLIKELY(buffer == NULL || work == NULL)) {
+        u6a_err_bad_alloc(err_optimize, (*ast_len + 1) * sizeof(struct ast_work));
+        free(buffer);
+        free(work);
+        return false;
+    }
+    // Rewrites by one pass may enable those by others, which are looked for again on the highest level
+    const uint32_t rounds = level >= U6A_OPT_MAX_LEVEL ? OPTIMIZE_MAX_ROUNDS : 1;
+    bool rewritten = true;
+    for (uint32_t round = 0; round < rounds && rewritten; ++round) {
+        rewritten = false;
+        for (uint32_t idx = 0; idx < PASSES_LEN; ++idx) {
+            struct pass* pass = passes + idx;
+            if (!pass->enabled || !PASS_ON_AST(pass)) {
+                continue;
+            }
+            struct timespec begin;
+            clock_gettime(CLOCK_MONOTONIC, &begin);
+            const uint64_t rewrites = pass->rewrites;
+            if (round == 0) {
+                pass->len_before = *ast_len;
+            }
+            if (pass->transform_ast) {
+                if (UNLIKELY(!pass->transform_ast(ast_arr, ast_len, &pass->rewrites))) {
+                    free(buffer);
+                    free(work);
+                    return false;
+                }
+            } else {
+                *ast_len = copy_ast(ast_arr, buffer, work, pass->rewrite_ast, &pass->rewrites);
+                memcpy(ast_arr, buffer, *ast_len * sizeof(struct u6a_ast_node));
+            }
+            rewritten |= pass->rewrites != rewrites;
+            pass->len_after = *ast_len;
+            pass->nsec += elapsed_nsec(&begin);
+        }
+    }
+    free(buffer);
+    free(work);
+    for (uint32_t idx = 0; idx < PASSES_LEN; ++idx) {
+        if (passes[idx].enabled && PASS_ON_AST(passes + idx)) {
+            print_stats(passes + idx);
+        }
+    }
+    return true;
+}
+
+bool
+u6a_optimize_share(const struct u6a_ast_node* ast_arr, uint32_t ast_len, uint32_t** share) {
+    *share = NULL;
+    for (uint32_t idx = 0; idx < PASSES_LEN; ++idx) {
+        struct pass* pass = passes + idx;
+        if (!pass->enabled || pass->share_ast == NULL) {
+            continue;
+        }
+        uint32_t* result = malloc(ast_len * sizeof(uint32_t));
+        if (UNLIKELY(result == NULL)) {
+            u6a_err_bad_alloc(err_optimize, ast_len * sizeof(uint32_t));
+            return false;
+        }
+        struct timespec begin;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        const uint64_t rewrites = pass->rewrites;
+        pass->len_before = ast_len;
+        if (UNLIKELY(!pass->share_ast(ast_arr, ast_len, result, &pass->len_after, &pass->rewrites))) {
+            free(result);
+            return false;
+        }
+        pass->nsec += elapsed_nsec(&begin);
+        print_stats(pass);
+        if (pass->rewrites == rewrites) {
+            free(result);
+        } else {
+            *share = result;
+        }
+        return true;
+    }
+    return true;
+}
+
+bool
+u6a_optimize_text(struct u6a_vm_ins* text, uint32_t* text_len, char* rodata, uint32_t* rodata_len) {
+    for (uint32_t idx = 0; idx < PASSES_LEN; ++idx) {
+        struct pass* pass = passes + idx;
+        if (!pass->enabled || pass->rewrite_text == NULL) {
+            continue;
+        }
+        struct timespec begin;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        pass->len_before = *text_len;
+        if (UNLIKELY(!pass->rewrite_text(text, text_len, rodata, rodata_len, &pass->rewrites))) {
+            return false;
+        }
+        pass->len_after = *text_len;
+        pass->nsec += elapsed_nsec(&begin);
+        print_stats(pass);
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+/*
+ * optimizer.h - Unlambda compile-time optimizer definitions
+ * 
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef U6A_OPTIMIZER_H_
+#define U6A_OPTIMIZER_H_
+
+#include "common.h"
+#include "defs.h"
+#include "vm_defs.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define U6A_OPT_MAX_LEVEL 3
+
+// Passes are enabled by optimization level, unless enabled or disabled by name. Returns false if no pass
+// goes by the given name.
+bool
+u6a_optimize_set_pass(const char* name, bool enabled);
+
+void
+u6a_optimize_init(uint32_t level);
+
+// Rewrites the AST in place, which never grows
+bool
+u6a_optimize_ast(struct u6a_ast_node* ast_arr, uint32_t* ast_len);
+
+// Finds subtrees occurring more than once, code of which is to be generated once as a subroutine. Each node in
+// place of which the subroutine is called is mapped to the first occurrence of the subtree in pre-order, and other
+// nodes to UINT32_MAX. Gives NULL if no subtree is to be shared, otherwise the caller frees it.
+bool
+u6a_optimize_share(const struct u6a_ast_node* ast_arr, uint32_t ast_len, uint32_t** share);
+
+// Rewrites text generated from the AST in place, which never grows. Room for rodata written by passes is
+// guaranteed by codegen.
+bool
+u6a_optimize_text(struct u6a_vm_ins* text, uint32_t* text_len, char* rodata, uint32_t* rodata_len);
+
+#endif
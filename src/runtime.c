@@ -22,25 +22,37 @@
 #include "vm_defs.h"
 #include "vm_stack.h"
 #include "vm_pool.h"
+#include "vm_memo.h"
+#include "vm_jit.h"
+#include "vm_output.h"
+#include "vm_input.h"
 
 #include <stdlib.h>
 #include <string.h>
-#include <arpa/inet.h>
-
-static struct u6a_vm_ins* text;
-static        uint32_t    text_len;
-static        char*       rodata;
-static        uint32_t    rodata_len;
-static        bool        force_exec;
-
-static const struct u6a_vm_ins text_subst[] = {
-    { .opcode = u6a_vo_la  },
-    { .opcode = u6a_vo_xch },
-    { .opcode = u6a_vo_la  },
-    { .opcode = u6a_vo_la  },
-    { .opcode = u6a_vo_la  }
-};
-static const uint32_t text_subst_len = sizeof(text_subst) / sizeof(struct u6a_vm_ins);
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+static const struct u6a_vm_ins* text;
+static        uint32_t          text_len;
+static const char*              rodata;
+static        uint32_t          rodata_len;
+static        void*             bc_image;      /* mapped bytecode file, or buffer holding sections read from stream */
+static        size_t            bc_image_size;
+static        bool              bc_image_mapped;
+static        uint32_t          features;      /* U6A_BC_FEATURE_*, functions used by the program */
+static        bool              force_exec;
+static        enum u6a_vm_gc    gc;
+static        bool              hash_cons;
+static        bool              memo;
+static        bool              jit;
+static struct u6a_vm_jit_ret   (*native_run)(const struct u6a_vm_jit_ops* ops, uint32_t offset);
+static        uint32_t          output_buffer_size;
+static        bool              output_thread;
+static        FILE*             bc_stream;
+
+static const struct u6a_vm_ins text_subst[] = U6A_VM_TEXT_SUBST;
 
 static const char* err_runtime = "runtime error";
 static const char* info_runtime = "runtime";
@@ -48,20 +60,21 @@ static const char* info_runtime = "runtime";
 #define CHECK_BC_HEADER_VER(file_header)                     \
     ( (file_header).ver_major == U6A_VER_MAJOR && (file_header).ver_minor == U6A_VER_MINOR )
 
-// Addref before free, for acc may equal to fn
+// References are moved rather than copied. When a function is applied, the value of acc has been
+// moved into func or arg (or is no longer needed), so that acc is overwritten without being freed.
 #define ACC_FN(fn_)                                          \
-    vm_var_fn_addref(fn_);                                   \
-    vm_var_fn_free(acc);                                     \
-    acc = fn_
-#define ACC_FN_INIT(fn_)                                     \
-    vm_var_fn_free(acc);                                     \
-    acc = fn_
+    *acc = fn_
 #define ACC_FN_REF(fn_, ref_)                                \
-    vm_var_fn_free(acc);                                     \
-    acc = U6A_VM_VAR_FN_REF(fn_, ref_);                      \
-    if (UNLIKELY(acc.ref == UINT32_MAX)) {                   \
+    *acc = U6A_VM_VAR_FN_REF(fn_, ref_);                     \
+    if (UNLIKELY(acc->ref == UINT32_MAX)) {                  \
         goto runtime_error;                                  \
     }
+// Tokens of primitive functions packed into the ref of a partial application
+#define VM_IMM_TOKEN(ref_, shift_)                           \
+    U6A_TOKEN((ref_) >> (shift_) & 0xFF, (ref_) >> ((shift_) + 8) & 0xFF)
+#define VM_VAR_FN_TOKEN(token_)                              \
+    (struct u6a_vm_var_fn) { .token = (token_) }
+
 #define CHECK_FORCE(log_func, err_val)                       \
     if (!force_exec) {                                       \
         log_func(err_runtime, err_val);                      \
@@ -69,7 +82,6 @@ static const char* info_runtime = "runtime";
     }
 
 #define STACK_PUSH1(fn_0)                                    \
-    vm_var_fn_addref(fn_0);                                  \
     if (UNLIKELY(!u6a_vm_stack_push1(fn_0))) {               \
         goto runtime_error;                                  \
     }
@@ -85,21 +97,108 @@ static const char* info_runtime = "runtime";
     if (UNLIKELY(!u6a_vm_stack_push4(fn_0, fn_1, fn_23))) {  \
         goto runtime_error;                                  \
     }
-#define STACK_POP()                                          \
-    vm_var_fn_free(top);                                     \
-    top = u6a_vm_stack_top();                                \
-    if (UNLIKELY(!u6a_vm_stack_pop())) {                     \
+#define STACK_POP(fn_)                                       \
+    if (UNLIKELY(!u6a_vm_stack_pop(&(fn_)))) {               \
         goto runtime_error;                                  \
     }
 
+#ifdef HAVE_COMPUTED_GOTO
+// Direct-threaded dispatch, each handler jumps straight to the next one through the jump table
+#define VM_JUMP_TABLE_FN      0x100
+#define VM_OP(op_)            vm_label_##op_
+#define VM_OP_DEFAULT         vm_label_op_default_
+#define VM_FN(fn_)            vm_label_##fn_
+#define VM_FN_DEFAULT         vm_label_fn_default_
+#define VM_DISPATCH_BEGIN()   VM_DISPATCH();
+#define VM_APPLY_BEGIN()
+#define VM_DISPATCH()         goto *jump_table[ins->opcode]
+#define VM_NEXT()             goto *jump_table[(++ins)->opcode]
+#define VM_APPLY()            goto *jump_table[VM_JUMP_TABLE_FN + func.token.fn]
+// Entry points into a handler past checks for functions the program does without
+#define VM_OP_VARIANT(op_, variant_)      vm_label_##op_##_##variant_
+#define VM_OP_ENTRY(op_, variant_)        VM_OP_VARIANT(op_, variant_):
+// Opcodes take the lower half of the table, and functions the upper half
+#define VM_JUMP_TABLE(sa_, xch_)                                                        \
+    {                                                                                   \
+        [0 ... VM_JUMP_TABLE_FN - 1]                     = &&VM_OP_DEFAULT,             \
+        [u6a_vo_app]                                     = &&VM_OP(u6a_vo_app),         \
+        [u6a_vo_app_ia]                                  = &&VM_OP(u6a_vo_app_ia),      \
+        [u6a_vo_app_ai]                                  = &&VM_OP(u6a_vo_app_ai),      \
+        [u6a_vo_la]                                      = &&VM_OP(u6a_vo_la),          \
+        [u6a_vo_sa]                                      = &&sa_,                       \
+        [u6a_vo_del]                                     = &&VM_OP(u6a_vo_del),         \
+        [u6a_vo_call]                                    = &&VM_OP(u6a_vo_call),        \
+        [u6a_vo_lc]                                      = &&VM_OP(u6a_vo_lc),          \
+        [u6a_vo_xch]                                     = &&xch_,                      \
+        [VM_JUMP_TABLE_FN ... VM_JUMP_TABLE_FN + 0xFF]   = &&VM_FN_DEFAULT,             \
+        [VM_JUMP_TABLE_FN + u6a_vf_s]                    = &&VM_FN(u6a_vf_s),           \
+        [VM_JUMP_TABLE_FN + u6a_vf_s1]                   = &&VM_FN(u6a_vf_s1),          \
+        [VM_JUMP_TABLE_FN + u6a_vf_s2]                   = &&VM_FN(u6a_vf_s2),          \
+        [VM_JUMP_TABLE_FN + u6a_vf_s1_imm]               = &&VM_FN(u6a_vf_s1_imm),      \
+        [VM_JUMP_TABLE_FN + u6a_vf_s2_imm]               = &&VM_FN(u6a_vf_s2_imm),      \
+        [VM_JUMP_TABLE_FN + u6a_vf_k]                    = &&VM_FN(u6a_vf_k),           \
+        [VM_JUMP_TABLE_FN + u6a_vf_k1]                   = &&VM_FN(u6a_vf_k1),          \
+        [VM_JUMP_TABLE_FN + u6a_vf_k1_imm]               = &&VM_FN(u6a_vf_k1_imm),      \
+        [VM_JUMP_TABLE_FN + u6a_vf_i]                    = &&VM_FN(u6a_vf_i),           \
+        [VM_JUMP_TABLE_FN + u6a_vf_out]                  = &&VM_FN(u6a_vf_out),         \
+        [VM_JUMP_TABLE_FN + u6a_vf_j]                    = &&VM_FN(u6a_vf_j),           \
+        [VM_JUMP_TABLE_FN + u6a_vf_f]                    = &&VM_FN(u6a_vf_f),           \
+        [VM_JUMP_TABLE_FN + u6a_vf_c]                    = &&VM_FN(u6a_vf_c),           \
+        [VM_JUMP_TABLE_FN + u6a_vf_d]                    = &&VM_FN(u6a_vf_d),           \
+        [VM_JUMP_TABLE_FN + u6a_vf_c1]                   = &&VM_FN(u6a_vf_c1),          \
+        [VM_JUMP_TABLE_FN + u6a_vf_m]                    = &&VM_FN(u6a_vf_m),           \
+        [VM_JUMP_TABLE_FN + u6a_vf_d1_c]                 = &&VM_FN(u6a_vf_d1_c),        \
+        [VM_JUMP_TABLE_FN + u6a_vf_d1_c_imm]             = &&VM_FN(u6a_vf_d1_c_imm),    \
+        [VM_JUMP_TABLE_FN + u6a_vf_d1_s]                 = &&VM_FN(u6a_vf_d1_s),        \
+        [VM_JUMP_TABLE_FN + u6a_vf_d1_d]                 = &&VM_FN(u6a_vf_d1_d),        \
+        [VM_JUMP_TABLE_FN + u6a_vf_v]                    = &&VM_FN(u6a_vf_v),           \
+        [VM_JUMP_TABLE_FN + u6a_vf_p]                    = &&VM_FN(u6a_vf_p),           \
+        [VM_JUMP_TABLE_FN + u6a_vf_in]                   = &&VM_FN(u6a_vf_in),          \
+        [VM_JUMP_TABLE_FN + u6a_vf_cmp]                  = &&VM_FN(u6a_vf_cmp),         \
+        [VM_JUMP_TABLE_FN + u6a_vf_pipe]                 = &&VM_FN(u6a_vf_pipe),        \
+        [VM_JUMP_TABLE_FN + u6a_vf_e]                    = &&VM_FN(u6a_vf_e)            \
+    }
+#else
+#define VM_OP(op_)            case op_
+#define VM_OP_DEFAULT         default
+#define VM_FN(fn_)            case fn_
+#define VM_FN_DEFAULT         default
+#define VM_DISPATCH_BEGIN()   while (true) switch (ins->opcode)
+#define VM_APPLY_BEGIN()      do_apply: switch (func.token.fn)
+#define VM_DISPATCH()         continue
+#define VM_NEXT()             ++ins; continue
+#define VM_APPLY()            goto do_apply
+// A case label can't be picked by the program, thus handlers always check for functions it may do without
+#define VM_OP_ENTRY(op_, variant_)
+#endif
+
+// Goes on as told by a handler shared with native code
+#define VM_CONTINUE(cont_)                                   \
+    switch (cont_) {                                         \
+        case vm_cont_next:                                   \
+            VM_NEXT();                                       \
+        case vm_cont_jump:                                   \
+            VM_DISPATCH();                                   \
+        case vm_cont_apply:                                  \
+            VM_APPLY();                                      \
+        case vm_cont_exit:                                   \
+            return U6A_VM_VAR_FN(acc);                       \
+        default:                                             \
+            goto runtime_error;                              \
+    }
+#define VM_APPLY_FN(name_)                                   \
+    VM_CONTINUE(vm_apply_##name_(&acc, &func, &arg, &ins))
+
 static inline bool
-read_bc_header(struct u6a_bc_header* restrict header, FILE* restrict input_stream) {
+read_bc_header(struct u6a_bc_header* restrict header, FILE* restrict input_stream, uint32_t* restrict header_end) {
+    uint32_t offset = 0;
     int ch;
     do {
         ch = fgetc(input_stream);
         if (UNLIKELY(ch == EOF)) {
             return false;
         }
+        ++offset;
     } while (ch != U6A_MAGIC);
     if (UNLIKELY(ch != ungetc(ch, input_stream))) {
         return false;
@@ -107,9 +206,186 @@ read_bc_header(struct u6a_bc_header* restrict header, FILE* restrict input_strea
     if (UNLIKELY(1 != fread(&header->file, U6A_BC_FILE_HEADER_SIZE, 1, input_stream))) {
         return false;
     }
-    if (LIKELY(header->file.prog_header_size >= U6A_BC_FILE_HEADER_SIZE)) {
-        return 1 == fread(&header->prog, header->file.prog_header_size, 1, input_stream);
+    memset(&header->prog, 0, U6A_BC_PROG_HEADER_SIZE);
+    const uint32_t prog_header_size = header->file.prog_header_size;
+    const uint32_t read_size = prog_header_size < U6A_BC_PROG_HEADER_SIZE ? prog_header_size : U6A_BC_PROG_HEADER_SIZE;
+    if (UNLIKELY(read_size && 1 != fread(&header->prog, read_size, 1, input_stream))) {
+        return false;
+    }
+    if (read_size < U6A_BC_PROG_HEADER_SIZE) {
+        header->prog.features = U6A_BC_FEATURES_ALL;
+    }
+    // Ignore trailing fields of program header from newer versions
+    for (uint32_t idx = read_size; idx < prog_header_size; ++idx) {
+        if (UNLIKELY(fgetc(input_stream) == EOF)) {
+            return false;
+        }
+    }
+    *header_end = offset - 1 + U6A_BC_FILE_HEADER_SIZE + prog_header_size;
+    return true;
+}
+
+static inline uint32_t
+bswap32(uint32_t val) {
+    return (val >> 24) | ((val >> 8) & 0xFF00) | ((val << 8) & 0xFF0000) | (val << 24);
+}
+
+static inline bool
+host_little_endian() {
+    const uint32_t probe = 1;
+    return *(const uint8_t*)&probe == 1;
+}
+
+// Converts program header to native byte order, returns false if the byte order is unrecognizable
+static inline bool
+check_byte_order(struct u6a_bc_header* restrict header, bool* restrict foreign) {
+    if (LIKELY(header->prog.byte_order == U6A_BC_BYTE_ORDER)) {
+        *foreign = false;
+        return true;
+    }
+    if (UNLIKELY(header->prog.byte_order != bswap32(U6A_BC_BYTE_ORDER))) {
+        return false;
+    }
+    *foreign = true;
+    header->prog.byte_order = U6A_BC_BYTE_ORDER;
+    header->prog.text_size = bswap32(header->prog.text_size);
+    header->prog.rodata_size = bswap32(header->prog.rodata_size);
+    header->prog.text_offset = bswap32(header->prog.text_offset);
+    header->prog.rodata_offset = bswap32(header->prog.rodata_offset);
+    header->prog.features = bswap32(header->prog.features);
+    return true;
+}
+
+static inline bool
+check_bc_layout(const struct u6a_bc_header* header, uint32_t header_end) {
+    const uint64_t text_end = (uint64_t)header->prog.text_offset + header->prog.text_size;
+    const uint64_t rodata_end = (uint64_t)header->prog.rodata_offset + header->prog.rodata_size;
+    return header->prog.text_size % sizeof(struct u6a_vm_ins) == 0
+        && header->prog.text_size / sizeof(struct u6a_vm_ins) >= U6A_VM_TEXT_SUBST_LEN
+        && header->prog.text_offset >= header_end
+        && header->prog.rodata_offset >= text_end
+        && rodata_end <= UINT32_MAX;
+}
+
+// Sections are used in place, which only works for native byte order
+static inline bool
+map_sections(const struct u6a_bc_header* header, FILE* input_stream) {
+    const int fd = fileno(input_stream);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    const size_t map_size = (size_t)header->prog.rodata_offset + header->prog.rodata_size;
+    if ((uint64_t)st.st_size < map_size) {
+        return false;
+    }
+    void* addr = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    bc_image = addr;
+    bc_image_size = map_size;
+    bc_image_mapped = true;
+    text = (const struct u6a_vm_ins*)((const char*)addr + header->prog.text_offset);
+    rodata = (const char*)addr + header->prog.rodata_offset;
+    return true;
+}
+
+static inline bool
+skip_bytes(FILE* input_stream, uint32_t len) {
+    while (len--) {
+        if (UNLIKELY(fgetc(input_stream) == EOF)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline bool
+read_sections(const struct u6a_bc_header* header, FILE* input_stream, uint32_t header_end) {
+    const uint32_t text_size = header->prog.text_size;
+    text = bc_image;
+    rodata = (const char*)bc_image + text_size;
+    return skip_bytes(input_stream, header->prog.text_offset - header_end)
+        && text_size == fread(bc_image, sizeof(char), text_size, input_stream)
+        && skip_bytes(input_stream, header->prog.rodata_offset - header->prog.text_offset - text_size)
+        && rodata_len == fread((char*)bc_image + text_size, sizeof(char), rodata_len, input_stream);
+}
+
+static inline uint32_t
+rodata_str_len(uint32_t offset) {
+    uint32_t len;
+    memcpy(&len, rodata + offset, sizeof(uint32_t));
+    return len;
+}
+
+// Sections read from a bytecode file of foreign byte order are converted in place
+static inline bool
+swap_sections() {
+    struct u6a_vm_ins* ins_arr = bc_image;
+    for (uint32_t idx = 0; idx < text_len; ++idx) {
+        if (ins_arr[idx].opcode & U6A_VM_OP_OFFSET) {
+            ins_arr[idx].operand.offset = bswap32(ins_arr[idx].operand.offset);
+        }
+    }
+    char* rodata_buffer = (char*)bc_image + text_len * sizeof(struct u6a_vm_ins);
+    for (uint32_t offset = 0; offset < rodata_len; ) {
+        if (UNLIKELY(rodata_len - offset < sizeof(uint32_t))) {
+            return false;
+        }
+        const uint32_t len = bswap32(rodata_str_len(offset));
+        memcpy(rodata_buffer + offset, &len, sizeof(uint32_t));
+        if (UNLIKELY(len > rodata_len - offset - sizeof(uint32_t))) {
+            return false;
+        }
+        offset = U6A_ALIGN_UP(offset + sizeof(uint32_t) + len, U6A_VM_RODATA_STR_ALIGN);
+    }
+    return true;
+}
+
+// Instructions are executed as is, so operands are checked beforehand, as well as functions used, which the
+// runtime may be specialized for. Operands stay offsets into text and rodata rather than being resolved into
+// pointers, as text may be mapped from the bytecode file and shared with other processes.
+static inline bool
+check_text(uint32_t* text_features) {
+    if (UNLIKELY(memcmp(text, text_subst, sizeof(text_subst)))) {
+        return false;
+    }
+    uint32_t used = 0;
+    for (const struct u6a_vm_ins* ins = text + U6A_VM_TEXT_SUBST_LEN; ins < text + text_len; ++ins) {
+        const uint32_t offset = ins->operand.offset;
+        switch (ins->opcode) {
+            case u6a_vo_app:
+                used |= U6A_BC_FEATURE_OF(ins->operand.fn.first.fn) | U6A_BC_FEATURE_OF(ins->operand.fn.second.fn);
+                break;
+            case u6a_vo_app_ia:
+                used |= U6A_BC_FEATURE_OF(ins->operand.fn.first.fn);
+                break;
+            case u6a_vo_app_ai:
+                used |= U6A_BC_FEATURE_OF(ins->operand.fn.second.fn);
+                break;
+            case u6a_vo_del:
+                used |= U6A_BC_FEATURE_D;
+                // fallthrough
+            case u6a_vo_sa:
+            case u6a_vo_call:
+                if (UNLIKELY(offset >= text_len)) {
+                    return false;
+                }
+                break;
+            case u6a_vo_lc:
+                if (ins->opcode_ex != u6a_vo_ex_print) {
+                    break;
+                }
+                if (UNLIKELY(offset % U6A_VM_RODATA_STR_ALIGN || rodata_len < sizeof(uint32_t)
+                        || offset > rodata_len - sizeof(uint32_t)
+                        || rodata_str_len(offset) > rodata_len - offset - sizeof(uint32_t))) {
+                    return false;
+                }
+                break;
+        }
     }
+    *text_features = used;
     return true;
 }
 
@@ -128,72 +404,601 @@ vm_var_fn_free(struct u6a_vm_var_fn var) {
     }
 }
 
+// Applications are carried out by the handlers below, shared by the interpreter and by native code (compiled by
+// the JIT, or ahead of time by u6ac), which calls the runtime for those it leaves. The function being applied owns
+// func and arg, and consumes them by either moving them elsewhere, or freeing them when discarded. Which
+// instruction comes next is told by the handler, leaving the caller to get there in its own way.
+enum vm_cont {
+    vm_cont_next,       /* instruction following ins */
+    vm_cont_jump,       /* instruction at ins */
+    vm_cont_apply,      /* apply func to arg */
+    vm_cont_exit,       /* program ends with acc */
+    vm_cont_error
+};
+
+#define VM_FN_HANDLER(name_)                                                            \
+    static U6A_ALWAYS_INLINE enum vm_cont                                               \
+    vm_apply_##name_(struct u6a_vm_var_fn* restrict acc U6A_UNUSED,                     \
+                     struct u6a_vm_var_fn* restrict func U6A_UNUSED,                    \
+                     struct u6a_vm_var_fn* restrict arg U6A_UNUSED,                     \
+                     const struct u6a_vm_ins** restrict ins U6A_UNUSED)
+
+#define VM_FN_ERROR()                                        \
+    runtime_error:                                           \
+    return vm_cont_error
+
+static int  current_char = EOF;
+static bool flush_before_read;
+
+VM_FN_HANDLER(s) {
+    if (U6A_VM_FN_IS_PRIM(arg->token.fn)) {
+        ACC_FN(U6A_VM_VAR_FN_REF(u6a_vf_s1_imm, U6A_VM_IMM(arg->token)));
+        return vm_cont_next;
+    }
+    ACC_FN_REF(u6a_vf_s1, u6a_vm_pool_alloc1(*arg));
+    return vm_cont_next;
+    VM_FN_ERROR();
+}
+
+VM_FN_HANDLER(s1) {
+    const union u6a_vm_var v1 = u6a_vm_pool_take1(func->ref);
+    ACC_FN_REF(u6a_vf_s2, u6a_vm_pool_alloc2(v1.fn, *arg));
+    return vm_cont_next;
+    VM_FN_ERROR();
+}
+
+VM_FN_HANDLER(s1_imm) {
+    if (U6A_VM_FN_IS_PRIM(arg->token.fn)) {
+        ACC_FN(U6A_VM_VAR_FN_REF(u6a_vf_s2_imm, func->ref | U6A_VM_IMM(arg->token) << 16));
+        return vm_cont_next;
+    }
+    ACC_FN_REF(u6a_vf_s2, u6a_vm_pool_alloc2(VM_VAR_FN_TOKEN(VM_IMM_TOKEN(func->ref, 0)), *arg));
+    return vm_cont_next;
+    VM_FN_ERROR();
+}
+
+static U6A_ALWAYS_INLINE enum vm_cont
+vm_apply_s2_tuple(struct u6a_vm_var_fn* restrict acc, struct u6a_vm_var_tuple tuple, struct u6a_vm_var_fn arg,
+                  const struct u6a_vm_ins** restrict ins) {
+    // The only place where a value is actually duplicated
+    vm_var_fn_addref(arg);
+    if (*ins == text + 0x03) {
+        STACK_PUSH3(arg, tuple);
+    } else {
+        STACK_PUSH4(U6A_VM_VAR_FN_REF(u6a_vf_j, *ins - text), arg, tuple);
+    }
+    ACC_FN(arg);
+    *ins = text;
+    return vm_cont_jump;
+    VM_FN_ERROR();
+}
+
+static inline struct u6a_vm_var_tuple
+vm_s2_tuple(struct u6a_vm_var_fn func) {
+    struct u6a_vm_var_tuple tuple;
+    if (func.token.fn == u6a_vf_s2) {
+        tuple = u6a_vm_pool_take2(func.ref);
+    } else {
+        tuple.v1.fn = VM_VAR_FN_TOKEN(VM_IMM_TOKEN(func.ref, 0));
+        tuple.v2.fn = VM_VAR_FN_TOKEN(VM_IMM_TOKEN(func.ref, 16));
+    }
+    return tuple;
+}
+
+// Pure applications have no effect but their result, which is recorded by `m` once reduced
+static enum vm_cont
+vm_apply_s2_memo(struct u6a_vm_var_fn* restrict acc, struct u6a_vm_var_fn func, struct u6a_vm_var_fn arg,
+                 const struct u6a_vm_ins** restrict ins) {
+    if (u6a_vm_memo_lookup(func, arg, acc)) {
+        vm_var_fn_free(func);
+        vm_var_fn_free(arg);
+        return vm_cont_next;
+    }
+    const struct u6a_vm_var_fn memo_fn = U6A_VM_VAR_FN_REF(u6a_vf_m,
+        u6a_vm_pool_alloc2(vm_var_fn_addref(func), vm_var_fn_addref(arg)));
+    if (UNLIKELY(memo_fn.ref == UINT32_MAX)) {
+        goto runtime_error;
+    }
+    if (*ins == text + 0x03) {
+        STACK_PUSH1(memo_fn);
+    } else {
+        STACK_PUSH2(U6A_VM_VAR_FN_REF(u6a_vf_j, *ins - text), memo_fn);
+    }
+    const struct u6a_vm_var_tuple tuple = vm_s2_tuple(func);
+    vm_var_fn_addref(arg);
+    STACK_PUSH3(arg, tuple);
+    ACC_FN(arg);
+    *ins = text;
+    return vm_cont_jump;
+    VM_FN_ERROR();
+}
+
+VM_FN_HANDLER(s2_imm) {
+    if (UNLIKELY(memo) && u6a_vm_pool_pure(*func) && u6a_vm_pool_pure(*arg)) {
+        return vm_apply_s2_memo(acc, *func, *arg, ins);
+    }
+    return vm_apply_s2_tuple(acc, vm_s2_tuple(*func), *arg, ins);
+}
+
+VM_FN_HANDLER(s2) {
+    if (UNLIKELY(memo) && u6a_vm_pool_pure(*func) && u6a_vm_pool_pure(*arg)) {
+        return vm_apply_s2_memo(acc, *func, *arg, ins);
+    }
+    return vm_apply_s2_tuple(acc, u6a_vm_pool_take2(func->ref), *arg, ins);
+}
+
+VM_FN_HANDLER(m) {
+    // Result of a pure application is recorded, then returned as `la` at the end of text_subst does
+    const struct u6a_vm_var_tuple tuple = u6a_vm_pool_take2(func->ref);
+    u6a_vm_memo_record(tuple.v1.fn, tuple.v2.fn, vm_var_fn_addref(*arg));
+    STACK_POP(*func);
+    return vm_cont_apply;
+    VM_FN_ERROR();
+}
+
+VM_FN_HANDLER(k) {
+    if (U6A_VM_FN_IS_PRIM(arg->token.fn)) {
+        ACC_FN(U6A_VM_VAR_FN_REF(u6a_vf_k1_imm, U6A_VM_IMM(arg->token)));
+        return vm_cont_next;
+    }
+    ACC_FN_REF(u6a_vf_k1, u6a_vm_pool_alloc1(*arg));
+    return vm_cont_next;
+    VM_FN_ERROR();
+}
+
+VM_FN_HANDLER(k1) {
+    vm_var_fn_free(*arg);
+    ACC_FN(u6a_vm_pool_take1(func->ref).fn);
+    return vm_cont_next;
+}
+
+VM_FN_HANDLER(k1_imm) {
+    vm_var_fn_free(*arg);
+    ACC_FN(VM_VAR_FN_TOKEN(VM_IMM_TOKEN(func->ref, 0)));
+    return vm_cont_next;
+}
+
+VM_FN_HANDLER(i) {
+    ACC_FN(*arg);
+    return vm_cont_next;
+}
+
+VM_FN_HANDLER(out) {
+    ACC_FN(*arg);
+    u6a_vm_output_putc(func->token.ch);
+    return vm_cont_next;
+}
+
+VM_FN_HANDLER(j) {
+    ACC_FN(*arg);
+    *ins = text + func->ref;
+    return vm_cont_next;
+}
+
+VM_FN_HANDLER(f) {
+    // Safe to assign IP here before jumping, as func won't be `j` or `f`
+    *ins = text + func->ref;
+    *func = *arg;
+    STACK_POP(*arg);
+    return vm_cont_apply;
+    VM_FN_ERROR();
+}
+
+VM_FN_HANDLER(c) {
+    void* ptr = u6a_vm_stack_save();
+    if (UNLIKELY(ptr == NULL)) {
+        goto runtime_error;
+    }
+    *func = *arg;
+    if (UNLIKELY(gc != u6a_vm_gc_refcount)) {
+        // Collector only sees uncounted refs on the stack, where func is kept for the moment
+        STACK_PUSH1(*func);
+    }
+    *arg = U6A_VM_VAR_FN_REF(u6a_vf_c1, u6a_vm_pool_alloc2_ptr(ptr, *ins - text));
+    if (UNLIKELY(arg->ref == UINT32_MAX)) {
+        goto runtime_error;
+    }
+    if (UNLIKELY(gc != u6a_vm_gc_refcount)) {
+        STACK_POP(*func);
+    }
+    return vm_cont_apply;
+    VM_FN_ERROR();
+}
+
+VM_FN_HANDLER(d) {
+    if (U6A_VM_FN_IS_PRIM(arg->token.fn)) {
+        ACC_FN(U6A_VM_VAR_FN_REF(u6a_vf_d1_c_imm, U6A_VM_IMM(arg->token)));
+        return vm_cont_next;
+    }
+    ACC_FN_REF(u6a_vf_d1_c, u6a_vm_pool_alloc1(*arg));
+    return vm_cont_next;
+    VM_FN_ERROR();
+}
+
+VM_FN_HANDLER(c1) {
+    const struct u6a_vm_var_tuple tuple = u6a_vm_pool_take2_ptr(func->ref);
+    if (UNLIKELY(!u6a_vm_stack_resume(tuple.v1.ptr))) {
+        return vm_cont_error;
+    }
+    *ins = text + tuple.v2.fn.ref;
+    ACC_FN(*arg);
+    return vm_cont_next;
+}
+
+VM_FN_HANDLER(d1_c) {
+    *func = u6a_vm_pool_take1(func->ref).fn;
+    return vm_cont_apply;
+}
+
+VM_FN_HANDLER(d1_c_imm) {
+    *func = VM_VAR_FN_TOKEN(VM_IMM_TOKEN(func->ref, 0));
+    return vm_cont_apply;
+}
+
+VM_FN_HANDLER(d1_s) {
+    // Promise of `YZ, which is evaluated by the end of text_subst, then applied to arg by `f`
+    struct u6a_vm_var_tuple tuple = u6a_vm_pool_take2(func->ref);
+    ACC_FN(tuple.v2.fn);
+    tuple.v2.fn = U6A_VM_VAR_FN_REF(u6a_vf_f, *ins - text);
+    STACK_PUSH3(*arg, tuple);
+    *ins = text + 0x03;
+    return vm_cont_jump;
+    VM_FN_ERROR();
+}
+
+VM_FN_HANDLER(d1_d) {
+    STACK_PUSH2(*arg, U6A_VM_VAR_FN_REF(u6a_vf_f, *ins - text));
+    *ins = text + func->ref;
+    return vm_cont_jump;
+    VM_FN_ERROR();
+}
+
+VM_FN_HANDLER(v) {
+    vm_var_fn_free(*arg);
+    acc->token.fn = u6a_vf_v;
+    return vm_cont_next;
+}
+
+VM_FN_HANDLER(p) {
+    ACC_FN(*arg);
+    u6a_vm_output_write(rodata + func->ref + sizeof(uint32_t), rodata_str_len(func->ref));
+    return vm_cont_next;
+}
+
+VM_FN_HANDLER(in) {
+    if (flush_before_read && !u6a_vm_input_buffered()) {
+        u6a_vm_output_flush();
+    }
+    current_char = u6a_vm_input_getc();
+    *func = *arg;
+    arg->token.fn = current_char == EOF ? u6a_vf_v : u6a_vf_i;
+    return vm_cont_apply;
+}
+
+VM_FN_HANDLER(cmp) {
+    const bool equal = func->token.ch == current_char;
+    *func = *arg;
+    arg->token.fn = equal ? u6a_vf_i : u6a_vf_v;
+    return vm_cont_apply;
+}
+
+VM_FN_HANDLER(pipe) {
+    *func = *arg;
+    if (UNLIKELY(current_char == EOF)) {
+        arg->token.fn = u6a_vf_v;
+    } else {
+        arg->token = U6A_TOKEN(u6a_vf_out, current_char);
+    }
+    return vm_cont_apply;
+}
+
+VM_FN_HANDLER(e) {
+    // Every program should terminate with explicit `e` function
+    u6a_vm_output_flush();
+    ACC_FN(*arg);
+    return vm_cont_exit;
+}
+
+VM_FN_HANDLER(invalid) {
+    CHECK_FORCE(u6a_err_invalid_vm_func, func->token.fn);
+    vm_var_fn_free(*func);
+    ACC_FN(*arg);
+    return vm_cont_next;
+    VM_FN_ERROR();
+}
+
+// `d`<top><top>, where a promise is made of the application on top of stack instead of evaluating it
+static U6A_ALWAYS_INLINE enum vm_cont
+vm_delay_top(struct u6a_vm_var_fn* restrict acc) {
+    struct u6a_vm_var_fn func, arg;
+    STACK_POP(func);
+    STACK_POP(arg);
+    ACC_FN_REF(u6a_vf_d1_s, u6a_vm_pool_alloc2(func, arg));
+    return vm_cont_next;
+    VM_FN_ERROR();
+}
+
+// Native code calls the runtime by the function being applied, each having its own entry
+static const u6a_vm_jit_apply_fn jit_apply_fns[0x100];
+
+// Packs acc as a whole, as assembling it field by field in memory stalls native code which reads it at once
+static inline struct u6a_vm_jit_ret
+vm_jit_ret(struct u6a_vm_var_fn acc, uint32_t next) {
+    const uint64_t bits = acc.token.fn | (uint64_t)acc.token.ch << 8 | (uint64_t)acc.reserved_ << 16
+        | (uint64_t)acc.ref << 32;
+    struct u6a_vm_jit_ret ret = { .next = next };
+    memcpy(&ret.acc, &bits, sizeof(uint64_t));
+    return ret;
+}
+
+#define JIT_ERROR()                                          \
+    (struct u6a_vm_jit_ret) { .next = U6A_VM_JIT_ERROR }
+
+#define JIT_APPLY_FN(name_)                                                                     \
+    static struct u6a_vm_jit_ret                                                                \
+    vm_jit_apply_##name_(struct u6a_vm_var_fn func, struct u6a_vm_var_fn arg, uint32_t offset) {   \
+        struct u6a_vm_var_fn acc = { 0 };                                                       \
+        const struct u6a_vm_ins* ins = text + offset;                                           \
+        switch (vm_apply_##name_(&acc, &func, &arg, &ins)) {                                    \
+            case vm_cont_next:                                                                  \
+                return vm_jit_ret(acc, ins + 1 - text);                                         \
+            case vm_cont_jump:                                                                  \
+                return vm_jit_ret(acc, ins - text);                                             \
+            case vm_cont_apply:                                                                 \
+                return jit_apply_fns[func.token.fn](func, arg, ins - text);                     \
+            case vm_cont_exit:                                                                  \
+                return vm_jit_ret(acc, U6A_VM_JIT_EXIT);                                        \
+            default:                                                                            \
+                return JIT_ERROR();                                                             \
+        }                                                                                       \
+    }
+
+JIT_APPLY_FN(s)
+JIT_APPLY_FN(s1)
+JIT_APPLY_FN(s1_imm)
+JIT_APPLY_FN(s2)
+JIT_APPLY_FN(s2_imm)
+JIT_APPLY_FN(m)
+JIT_APPLY_FN(k)
+JIT_APPLY_FN(k1)
+JIT_APPLY_FN(k1_imm)
+JIT_APPLY_FN(i)
+JIT_APPLY_FN(out)
+JIT_APPLY_FN(j)
+JIT_APPLY_FN(f)
+JIT_APPLY_FN(c)
+JIT_APPLY_FN(d)
+JIT_APPLY_FN(c1)
+JIT_APPLY_FN(d1_c)
+JIT_APPLY_FN(d1_c_imm)
+JIT_APPLY_FN(d1_s)
+JIT_APPLY_FN(d1_d)
+JIT_APPLY_FN(v)
+JIT_APPLY_FN(p)
+JIT_APPLY_FN(in)
+JIT_APPLY_FN(cmp)
+JIT_APPLY_FN(pipe)
+JIT_APPLY_FN(e)
+JIT_APPLY_FN(invalid)
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+static const u6a_vm_jit_apply_fn jit_apply_fns[0x100] = {
+    [0 ... 0xFF]       = vm_jit_apply_invalid,
+    [u6a_vf_s]         = vm_jit_apply_s,
+    [u6a_vf_s1]        = vm_jit_apply_s1,
+    [u6a_vf_s1_imm]    = vm_jit_apply_s1_imm,
+    [u6a_vf_s2]        = vm_jit_apply_s2,
+    [u6a_vf_s2_imm]    = vm_jit_apply_s2_imm,
+    [u6a_vf_m]         = vm_jit_apply_m,
+    [u6a_vf_k]         = vm_jit_apply_k,
+    [u6a_vf_k1]        = vm_jit_apply_k1,
+    [u6a_vf_k1_imm]    = vm_jit_apply_k1_imm,
+    [u6a_vf_i]         = vm_jit_apply_i,
+    [u6a_vf_out]       = vm_jit_apply_out,
+    [u6a_vf_j]         = vm_jit_apply_j,
+    [u6a_vf_f]         = vm_jit_apply_f,
+    [u6a_vf_c]         = vm_jit_apply_c,
+    [u6a_vf_d]         = vm_jit_apply_d,
+    [u6a_vf_c1]        = vm_jit_apply_c1,
+    [u6a_vf_d1_c]      = vm_jit_apply_d1_c,
+    [u6a_vf_d1_c_imm]  = vm_jit_apply_d1_c_imm,
+    [u6a_vf_d1_s]      = vm_jit_apply_d1_s,
+    [u6a_vf_d1_d]      = vm_jit_apply_d1_d,
+    [u6a_vf_v]         = vm_jit_apply_v,
+    [u6a_vf_p]         = vm_jit_apply_p,
+    [u6a_vf_in]        = vm_jit_apply_in,
+    [u6a_vf_cmp]       = vm_jit_apply_cmp,
+    [u6a_vf_pipe]      = vm_jit_apply_pipe,
+    [u6a_vf_e]         = vm_jit_apply_e
+};
+#pragma GCC diagnostic pop
+
+static struct u6a_vm_jit_ret
+vm_jit_delay_top(uint32_t ins) {
+    struct u6a_vm_var_fn acc;
+    if (UNLIKELY(vm_delay_top(&acc) != vm_cont_next)) {
+        return JIT_ERROR();
+    }
+    return vm_jit_ret(acc, ins + 1);
+}
+
+static struct u6a_vm_jit_ret
+vm_jit_invalid(uint32_t ins) {
+    if (text[ins].opcode == u6a_vo_lc) {
+        u6a_err_invalid_ex_opcode(err_runtime, text[ins].opcode_ex);
+    } else {
+        u6a_err_invalid_opcode(err_runtime, text[ins].opcode);
+    }
+    return JIT_ERROR();
+}
+
+static const struct u6a_vm_jit_ops native_ops = {
+    .apply     = jit_apply_fns,
+    .delay_top = vm_jit_delay_top,
+    .invalid   = vm_jit_invalid
+};
+
 bool
 u6a_runtime_info(FILE* restrict input_stream, const char* file_name) {
     struct u6a_bc_header header;
-    if (UNLIKELY(!read_bc_header(&header, input_stream))) {
+    uint32_t header_end;
+    if (UNLIKELY(!read_bc_header(&header, input_stream, &header_end))) {
         u6a_err_invalid_bc_file(err_runtime, file_name);
         return false;
     }
     printf("Version: %d.%d.X\n", header.file.ver_major, header.file.ver_minor);
     if (LIKELY(CHECK_BC_HEADER_VER(header.file))) {
-        if (LIKELY(header.file.prog_header_size == U6A_BC_FILE_HEADER_SIZE)) {
-            printf("Size of section .text   (bytes): 0x%08X\n", ntohl(header.prog.text_size));
-            printf("Size of section .rodata (bytes): 0x%08X\n", ntohl(header.prog.rodata_size));
+        bool foreign;
+        if (LIKELY(header.file.prog_header_size >= U6A_BC_PROG_HEADER_MIN_SIZE
+                && check_byte_order(&header, &foreign))) {
+            printf("Byte order: %s-endian\n", host_little_endian() != foreign ? "little" : "big");
+            printf("Size of section .text   (bytes): 0x%08X\n", header.prog.text_size);
+            printf("Size of section .rodata (bytes): 0x%08X\n", header.prog.rodata_size);
+            printf("Offset of section .text   (bytes): 0x%08X\n", header.prog.text_offset);
+            printf("Offset of section .rodata (bytes): 0x%08X\n", header.prog.rodata_offset);
+            if (header.prog.features == U6A_BC_FEATURES_ALL) {
+                printf("Functions used: unknown\n");
+            } else if (header.prog.features == 0) {
+                printf("Functions used: none of c d @ ?X |\n");
+            } else {
+                const uint32_t mask = header.prog.features;
+                printf("Functions used: %s%s%s%s%s\n", mask & U6A_BC_FEATURE_C ? " c" : "",
+                    mask & U6A_BC_FEATURE_D ? " d" : "", mask & U6A_BC_FEATURE_IN ? " @" : "",
+                    mask & U6A_BC_FEATURE_CMP ? " ?X" : "", mask & U6A_BC_FEATURE_PIPE ? " |" : "");
+            }
         } else {
-            printf("Program header unrecognizable (%d bytes)", header.file.prog_header_size);
+            printf("Program header unrecognizable (%d bytes)\n", header.file.prog_header_size);
         }
     }
     return true;
 }
 
-bool
-u6a_runtime_init(struct u6a_runtime_options* options) {
+static inline bool
+load_bc(struct u6a_runtime_options* options, uint32_t* prog_features) {
     struct u6a_bc_header header;
-    if (UNLIKELY(!read_bc_header(&header, options->istream))) {
+    uint32_t header_end;
+    bool foreign;
+    if (UNLIKELY(!read_bc_header(&header, options->istream, &header_end))) {
         u6a_err_invalid_bc_file(err_runtime, options->file_name);
         return false;
     }
     if (UNLIKELY(!CHECK_BC_HEADER_VER(header.file))) {
-        if (!options->force_exec || header.file.prog_header_size != U6A_BC_FILE_HEADER_SIZE) {
+        if (!options->force_exec || header.file.prog_header_size < U6A_BC_PROG_HEADER_MIN_SIZE) {
             u6a_err_bad_bc_ver(err_runtime, options->file_name, header.file.ver_major, header.file.ver_minor);
             return false;
         }
     }
-    header.prog.text_size = ntohl(header.prog.text_size);
-    header.prog.rodata_size = ntohl(header.prog.rodata_size);
-    text = malloc(header.prog.text_size + sizeof(text_subst));
-    if (UNLIKELY(text == NULL)) {
-        u6a_err_bad_alloc(err_runtime, header.prog.text_size + sizeof(text_subst));
+    if (UNLIKELY(header.file.prog_header_size < U6A_BC_PROG_HEADER_MIN_SIZE || !check_byte_order(&header, &foreign))) {
+        u6a_err_invalid_bc_file(err_runtime, options->file_name);
         return false;
     }
-    text_len = header.prog.text_size / sizeof(struct u6a_vm_ins);
-    rodata = malloc(header.prog.rodata_size);
-    if (UNLIKELY(rodata == NULL)) {
-        u6a_err_bad_alloc(err_runtime, header.prog.rodata_size);
-        free(text);
+    if (UNLIKELY(!check_bc_layout(&header, header_end))) {
+        u6a_err_invalid_bc_file(err_runtime, options->file_name);
         return false;
     }
+    text_len = header.prog.text_size / sizeof(struct u6a_vm_ins);
     rodata_len = header.prog.rodata_size / sizeof(char);
-    memcpy(text, text_subst, sizeof(text_subst));
-    if (UNLIKELY(text_len != fread(text + text_subst_len, sizeof(struct u6a_vm_ins), text_len, options->istream))) {
+    // Bytecode read from STDIN is followed by program input, thus cannot be mapped
+    if (foreign || options->istream == stdin || !map_sections(&header, options->istream)) {
+        bc_image_size = (size_t)header.prog.text_size + header.prog.rodata_size;
+        bc_image = malloc(bc_image_size);
+        if (UNLIKELY(bc_image == NULL)) {
+            u6a_err_bad_alloc(err_runtime, bc_image_size);
+            return false;
+        }
+        if (UNLIKELY(!read_sections(&header, options->istream, header_end))) {
+            u6a_err_invalid_bc_file(err_runtime, options->file_name);
+            return false;
+        }
+        if (UNLIKELY(foreign && !swap_sections())) {
+            u6a_err_invalid_bc_file(err_runtime, options->file_name);
+            return false;
+        }
+    }
+    *prog_features = header.prog.features;
+    return true;
+}
+
+// Sections of a native program (or bundled bytecode) are compiled into it, thus need no loading
+static inline bool
+load_native(struct u6a_runtime_options* options, uint32_t* prog_features) {
+    const struct u6a_runtime_native* prog = options->native;
+    if (UNLIKELY(prog->ver_major != U6A_VER_MAJOR || prog->ver_minor != U6A_VER_MINOR)) {
+        u6a_err_bad_bc_ver(err_runtime, options->file_name, prog->ver_major, prog->ver_minor);
+        return false;
+    }
+    text = prog->text;
+    text_len = prog->text_len;
+    rodata = prog->rodata;
+    rodata_len = prog->rodata_len;
+    *prog_features = prog->features;
+    return true;
+}
+
+bool
+u6a_runtime_init(struct u6a_runtime_options* options) {
+    uint32_t prog_features;
+    if (options->native) {
+        if (UNLIKELY(!load_native(options, &prog_features))) {
+            goto runtime_init_failed;
+        }
+    } else if (UNLIKELY(!load_bc(options, &prog_features))) {
+        goto runtime_init_failed;
+    }
+    uint32_t text_features;
+    if (UNLIKELY(!check_text(&text_features))) {
+        u6a_err_invalid_bc_file(err_runtime, options->file_name);
         goto runtime_init_failed;
     }
-    if (UNLIKELY(rodata_len != fread(rodata, sizeof(char), rodata_len, options->istream))) {
+    features = prog_features;
+    if (UNLIKELY(text_features & ~features)) {
+        // Specialized execution goes wrong with functions not declared in header
+        if (!options->force_exec) {
+            u6a_err_invalid_bc_file(err_runtime, options->file_name);
+            goto runtime_init_failed;
+        }
+        features |= text_features;
+    }
+    u6a_info_verbose(info_runtime, "features: 0x%02" PRIX32 "%s%s%s", features,
+        features & U6A_BC_FEATURE_C ? "" : ", growing stack segments without `c`",
+        features & U6A_BC_FEATURE_D ? "" : ", skipping promise checks without `d`",
+        features & U6A_BC_FEATURE_IN ? "" : ", skipping input without `@`");
+    uint32_t stack_segment_max_size = options->stack_segment_max_size;
+    if (!(features & U6A_BC_FEATURE_C) && stack_segment_max_size == 0) {
+        // Without continuations sharing segments, the stack may as well be (almost) contiguous
+        stack_segment_max_size = U6A_VM_MAX_STACK_SEGMENT_SIZE;
+    }
+    if (UNLIKELY(!u6a_vm_stack_init(options->stack_segment_size, stack_segment_max_size, err_runtime))) {
         goto runtime_init_failed;
     }
-    if (UNLIKELY(!u6a_vm_stack_init(options->stack_segment_size, err_runtime))) {
+    if (UNLIKELY(!u6a_vm_pool_init(options->pool_size, options->pool_max_size, options->pool_huge_pages,
+            options->gc, options->hash_cons, options->memo, err_runtime))) {
         goto runtime_init_failed;
     }
-    if (UNLIKELY(!u6a_vm_pool_init(options->pool_size, text_len, err_runtime))) {
+    if (options->memo && UNLIKELY(!u6a_vm_memo_init(U6A_VM_MEMO_SIZE, err_runtime))) {
         goto runtime_init_failed;
     }
-    for (struct u6a_vm_ins* ins = text + text_subst_len; ins < text + text_len; ++ins) {
-        if (ins->opcode & U6A_VM_OP_OFFSET) {
-            ins->operand.offset = ntohl(ins->operand.offset);
+#ifdef HAVE_JIT
+    if (options->jit) {
+        if (UNLIKELY(!u6a_vm_jit_init(text, text_len, &native_ops, features & U6A_BC_FEATURE_D, options->force_exec,
+                err_runtime))) {
+            goto runtime_init_failed;
         }
+        const struct u6a_vm_jit_stats* jit_stats = u6a_vm_jit_stats();
+        u6a_info_verbose(info_runtime, "text compiled into %" PRIu32 " bytes of native code in %" PRIu64 " us",
+            jit_stats->code_size, jit_stats->compile_nsec / 1000);
     }
+#endif
     force_exec = options->force_exec;
+    gc = options->gc;
+    hash_cons = options->hash_cons;
+    memo = options->memo;
+    jit = options->jit;
+    native_run = options->native ? options->native->run : NULL;
+    output_buffer_size = options->output_buffer_size;
+    output_thread = options->output_thread;
+    bc_stream = options->istream;
     return true;
 
     runtime_init_failed:
@@ -203,182 +1008,153 @@ u6a_runtime_init(struct u6a_runtime_options* options) {
 
 U6A_HOT union u6a_vm_var
 u6a_runtime_execute(FILE* restrict istream, FILE* restrict ostream) {
-    struct u6a_vm_var_fn acc = { 0 }, top = { 0 };
-    struct u6a_vm_ins* ins = text + text_subst_len;
-    int current_char = EOF;
+#ifdef HAVE_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+    static const void* const jump_table_d[VM_JUMP_TABLE_FN + 0x100] =
+        VM_JUMP_TABLE(VM_OP(u6a_vo_sa), VM_OP(u6a_vo_xch));
+    // Without `d`, no promise is to be made when acc is pushed onto stack
+    static const void* const jump_table_no_d[VM_JUMP_TABLE_FN + 0x100] =
+        VM_JUMP_TABLE(VM_OP_VARIANT(u6a_vo_sa, no_d), VM_OP_VARIANT(u6a_vo_xch, no_d));
+#pragma GCC diagnostic pop
+    const void* const* const jump_table = features & U6A_BC_FEATURE_D ? jump_table_d : jump_table_no_d;
+#endif
+    struct u6a_vm_var_fn acc = { 0 };
+    const struct u6a_vm_ins* ins = text + U6A_VM_TEXT_SUBST_LEN;
     struct u6a_vm_var_fn func = { 0 }, arg = { 0 };
-    struct u6a_vm_var_tuple tuple;
-    void* ptr;
-    while (true) {
-        switch (ins->opcode) {
-            case u6a_vo_app:
-                if (ins->operand.fn.first.fn) {
-                    func.token = ins->operand.fn.first;
-                } else {
-                    func = acc;
-                    goto arg_from_ins;
-                }
-                if (ins->operand.fn.second.fn) {
-                    arg_from_ins:
-                    arg.token = ins->operand.fn.second;
-                } else {
-                    arg = acc;
-                }
-                goto do_apply;
-            case u6a_vo_la:
-                STACK_POP();
-                func = top;
-                arg = acc;
-                do_apply:
-                switch (func.token.fn) {
-                    case u6a_vf_s:
-                        vm_var_fn_addref(arg);
-                        ACC_FN_REF(u6a_vf_s1, u6a_vm_pool_alloc1(arg));
-                        break;
-                    case u6a_vf_s1:
-                        vm_var_fn_addref(arg);
-                        vm_var_fn_addref(u6a_vm_pool_get1(func.ref).fn);
-                        ACC_FN_REF(u6a_vf_s2, u6a_vm_pool_alloc2(u6a_vm_pool_get1(func.ref).fn, arg));
-                        break;
-                    case u6a_vf_s2:
-                        tuple = u6a_vm_pool_get2(func.ref);
-                        vm_var_fn_addref(tuple.v1.fn);
-                        vm_var_fn_addref(tuple.v2.fn);
-                        vm_var_fn_addref(arg);
-                        if (ins - text == 0x03) {
-                            STACK_PUSH3(arg, tuple);
-                        } else {
-                            STACK_PUSH4(U6A_VM_VAR_FN_REF(u6a_vf_j, ins - text), arg, tuple);
-                        }
-                        ACC_FN(arg);
-                        ins = text;
-                        continue;
-                    case u6a_vf_k:
-                        vm_var_fn_addref(arg);
-                        ACC_FN_REF(u6a_vf_k1, u6a_vm_pool_alloc1(arg));
-                        break;
-                    case u6a_vf_k1:
-                        ACC_FN(u6a_vm_pool_get1(func.ref).fn);
-                        break;
-                    case u6a_vf_i:
-                        ACC_FN(arg);
-                        break;
-                    case u6a_vf_out:
-                        ACC_FN(arg);
-                        fputc(func.token.ch, ostream);
-                        break;
-                    case u6a_vf_j:
-                        ACC_FN(arg);
-                        ins = text + func.ref;
-                        break;
-                    case u6a_vf_f:
-                        // Safe to assign IP here before jumping, as func won't be `j` or `f`
-                        ins = text + func.ref;
-                        STACK_POP();
-                        func = acc;
-                        arg = top;
-                        goto do_apply;
-                    case u6a_vf_c:
-                        ptr = u6a_vm_stack_save();
-                        if (UNLIKELY(ptr == NULL)) {
-                            goto runtime_error;
-                        }
-                        ACC_FN_REF(u6a_vf_c1, u6a_vm_pool_alloc2_ptr(ptr, ins));
-                        break;
-                    case u6a_vf_d:
-                        ACC_FN_REF(u6a_vf_d1_c, u6a_vm_pool_alloc1(arg));
-                        break;
-                    case u6a_vf_c1:
-                        tuple = u6a_vm_pool_get2_separate(func.ref);
-                        u6a_vm_stack_resume(tuple.v1.ptr);
-                        ins = tuple.v2.ptr;
-                        ACC_FN(arg);
-                        break;
-                    case u6a_vf_d1_c:
-                        func = u6a_vm_pool_get1(func.ref).fn;
-                        goto do_apply;
-                    case u6a_vf_d1_s:
-                        tuple = u6a_vm_pool_get2(func.ref);
-                        STACK_PUSH1(tuple.v1.fn);
-                        ACC_FN(tuple.v2.fn);
-                        ins = text + 0x03;
-                        continue;
-                    case u6a_vf_d1_d:
-                        STACK_PUSH2(vm_var_fn_addref(arg), U6A_VM_VAR_FN_REF(u6a_vf_f, ins - text));
-                        ins = text + func.ref;
-                        continue;
-                    case u6a_vf_v:
-                        vm_var_fn_free(acc);
-                        acc.token.fn = u6a_vf_v;
-                        break;
-                    case u6a_vf_p:
-                        ACC_FN(arg);
-                        fputs(rodata + func.ref, ostream);
-                        break;
-                    case u6a_vf_in:
-                        current_char = fgetc(istream);
-                        func = arg;
-                        arg.token.fn = current_char == EOF ? u6a_vf_v : u6a_vf_i;
-                        goto do_apply;
-                    case u6a_vf_cmp:
-                        if (func.token.ch == current_char) {
-                            func = arg;
-                            arg.token.fn = u6a_vf_i;
-                        } else {
-                            func = arg;
-                            arg.token.fn = u6a_vf_v;
-                        }
-                        goto do_apply;
-                    case u6a_vf_pipe:
-                        func = arg;
-                        if (UNLIKELY(current_char == EOF)) {
-                            arg.token.fn = u6a_vf_v;
-                        } else {
-                            arg.token = U6A_TOKEN(u6a_vf_out, current_char);
-                        }
-                        goto do_apply;
-                    case u6a_vf_e:
-                        // Every program should terminate with explicit `e` function
-                        return U6A_VM_VAR_FN(arg);
-                    default:
-                        CHECK_FORCE(u6a_err_invalid_vm_func, func.token.fn);
-                }
-                break;
-            case u6a_vo_sa:
-                if (acc.token.fn == u6a_vf_d) {
-                    goto delay;
-                }
-                STACK_PUSH1(acc);
-                break;
-            case u6a_vo_xch:
-                if (UNLIKELY(acc.token.fn == u6a_vf_d)) {
-                    STACK_POP();
-                    func = top;
-                    STACK_POP();
-                    arg = top;
-                    ACC_FN_REF(u6a_vf_d1_s, u6a_vm_pool_alloc2(func, arg));
-                } else {
-                    acc = u6a_vm_stack_xch(acc);
-                }
-                break;
-            case u6a_vo_del:
-                delay:
-                ACC_FN_INIT(U6A_VM_VAR_FN_REF(u6a_vf_d1_d, ins + 1 - text));
-                ins = text + text_subst_len + ins->operand.offset;
-                continue;
-            case u6a_vo_lc:
-                switch (ins->opcode_ex) {
-                    case u6a_vo_ex_print:
-                        ACC_FN_INIT(U6A_VM_VAR_FN_REF(u6a_vf_p, ins->operand.offset));
-                        break;
-                    default:
-                        CHECK_FORCE(u6a_err_invalid_ex_opcode, ins->opcode_ex);
-                }
-                break;
-            default:
-                CHECK_FORCE(u6a_err_invalid_opcode, ins->opcode);
+    fflush(ostream);
+    if (UNLIKELY(!u6a_vm_output_init(fileno(ostream), output_buffer_size, output_thread, err_runtime))) {
+        goto runtime_error;
+    }
+    if (features & U6A_BC_FEATURE_IN) {
+        if (UNLIKELY(!u6a_vm_input_init(istream, istream == bc_stream, err_runtime))) {
+            goto runtime_error;
+        }
+    }
+    current_char = EOF;
+    // Pending output should be visible before blocking on an interactive read
+    flush_before_read = u6a_vm_output_interactive() || isatty(fileno(istream));
+    if (native_run || jit) {
+#ifdef HAVE_JIT
+        const struct u6a_vm_jit_ret result = native_run ? native_run(&native_ops, ins - text)
+                                                        : u6a_vm_jit_run(ins - text);
+#else
+        const struct u6a_vm_jit_ret result = native_run(&native_ops, ins - text);
+#endif
+        if (UNLIKELY(result.next != U6A_VM_JIT_EXIT)) {
+            goto runtime_error;
         }
-        ++ins;
+        return U6A_VM_VAR_FN(result.acc);
+    }
+    VM_DISPATCH_BEGIN() {
+        VM_OP(u6a_vo_app):
+            func.token = ins->operand.fn.first;
+            arg.token = ins->operand.fn.second;
+            VM_APPLY();
+        VM_OP(u6a_vo_app_ia):
+            func.token = ins->operand.fn.first;
+            arg = acc;
+            VM_APPLY();
+        VM_OP(u6a_vo_app_ai):
+            func = acc;
+            arg.token = ins->operand.fn.second;
+            VM_APPLY();
+        VM_OP(u6a_vo_la):
+            STACK_POP(func);
+            arg = acc;
+            VM_APPLY();
+        VM_APPLY_BEGIN() {
+            VM_FN(u6a_vf_s):
+                VM_APPLY_FN(s);
+            VM_FN(u6a_vf_s1):
+                VM_APPLY_FN(s1);
+            VM_FN(u6a_vf_s1_imm):
+                VM_APPLY_FN(s1_imm);
+            VM_FN(u6a_vf_s2_imm):
+                VM_APPLY_FN(s2_imm);
+            VM_FN(u6a_vf_s2):
+                VM_APPLY_FN(s2);
+            VM_FN(u6a_vf_m):
+                VM_APPLY_FN(m);
+            VM_FN(u6a_vf_k):
+                VM_APPLY_FN(k);
+            VM_FN(u6a_vf_k1):
+                VM_APPLY_FN(k1);
+            VM_FN(u6a_vf_k1_imm):
+                VM_APPLY_FN(k1_imm);
+            VM_FN(u6a_vf_i):
+                VM_APPLY_FN(i);
+            VM_FN(u6a_vf_out):
+                VM_APPLY_FN(out);
+            VM_FN(u6a_vf_j):
+                VM_APPLY_FN(j);
+            VM_FN(u6a_vf_f):
+                VM_APPLY_FN(f);
+            VM_FN(u6a_vf_c):
+                VM_APPLY_FN(c);
+            VM_FN(u6a_vf_d):
+                VM_APPLY_FN(d);
+            VM_FN(u6a_vf_c1):
+                VM_APPLY_FN(c1);
+            VM_FN(u6a_vf_d1_c):
+                VM_APPLY_FN(d1_c);
+            VM_FN(u6a_vf_d1_c_imm):
+                VM_APPLY_FN(d1_c_imm);
+            VM_FN(u6a_vf_d1_s):
+                VM_APPLY_FN(d1_s);
+            VM_FN(u6a_vf_d1_d):
+                VM_APPLY_FN(d1_d);
+            VM_FN(u6a_vf_v):
+                VM_APPLY_FN(v);
+            VM_FN(u6a_vf_p):
+                VM_APPLY_FN(p);
+            VM_FN(u6a_vf_in):
+                VM_APPLY_FN(in);
+            VM_FN(u6a_vf_cmp):
+                VM_APPLY_FN(cmp);
+            VM_FN(u6a_vf_pipe):
+                VM_APPLY_FN(pipe);
+            VM_FN(u6a_vf_e):
+                VM_APPLY_FN(e);
+            VM_FN_DEFAULT:
+                VM_APPLY_FN(invalid);
+        }
+        VM_OP(u6a_vo_sa):
+            if (acc.token.fn == u6a_vf_d) {
+                goto delay;
+            }
+            VM_OP_ENTRY(u6a_vo_sa, no_d)
+            STACK_PUSH1(acc);
+            VM_NEXT();
+        VM_OP(u6a_vo_xch):
+            if (UNLIKELY(acc.token.fn == u6a_vf_d)) {
+                VM_CONTINUE(vm_delay_top(&acc));
+            }
+            VM_OP_ENTRY(u6a_vo_xch, no_d)
+            if (UNLIKELY(!u6a_vm_stack_xch(&acc))) {
+                goto runtime_error;
+            }
+            VM_NEXT();
+        VM_OP(u6a_vo_del):
+            delay:
+            acc = U6A_VM_VAR_FN_REF(u6a_vf_d1_d, ins + 1 - text);
+            ins = text + ins->operand.offset;
+            VM_DISPATCH();
+        VM_OP(u6a_vo_call):
+            // Shared code returns here by the `la` at its end, as it does when applying ``sXY
+            STACK_PUSH1(U6A_VM_VAR_FN_REF(u6a_vf_j, ins - text));
+            ins = text + ins->operand.offset;
+            VM_DISPATCH();
+        VM_OP(u6a_vo_lc):
+            if (LIKELY(ins->opcode_ex == u6a_vo_ex_print)) {
+                acc = U6A_VM_VAR_FN_REF(u6a_vf_p, ins->operand.offset);
+            } else {
+                CHECK_FORCE(u6a_err_invalid_ex_opcode, ins->opcode_ex);
+            }
+            VM_NEXT();
+        VM_OP_DEFAULT:
+            CHECK_FORCE(u6a_err_invalid_opcode, ins->opcode);
+            VM_NEXT();
     }
 
     runtime_error:
@@ -387,8 +1163,54 @@ u6a_runtime_execute(FILE* restrict istream, FILE* restrict ostream) {
 
 void
 u6a_runtime_destroy() {
-    free(text);
-    free(rodata);
+    u6a_vm_output_destroy();
+    u6a_vm_input_destroy();
+    if (text) {
+        const struct u6a_vm_stack_stats* stack_stats = u6a_vm_stack_stats();
+        u6a_info_verbose(info_runtime, "stack segments split %" PRIu64 " times, joined %" PRIu64 " times",
+            stack_stats->splits, stack_stats->joins);
+        u6a_info_verbose(info_runtime, "stack segments allocated %" PRIu64 ", reused %" PRIu64,
+            stack_stats->seg_allocs, stack_stats->seg_reuses);
+        u6a_info_verbose(info_runtime, "stack captured %" PRIu64 " times, %" PRIu64 " elements popped from captured ones",
+            stack_stats->captures, stack_stats->shared_pops);
+        u6a_info_verbose(info_runtime, "continuations resumed in place %" PRIu64 " times, escaped %" PRIu64 " times",
+            stack_stats->unwinds, stack_stats->escapes);
+        const struct u6a_vm_pool_stats* pool_stats = u6a_vm_pool_stats();
+        u6a_info_verbose(info_runtime, "pool grown to %" PRIu32 " elements, %" PRIu64 " emptied regions released",
+            pool_stats->len, pool_stats->released);
+        if (gc == u6a_vm_gc_tracing) {
+            u6a_info_verbose(info_runtime, "pool collected %" PRIu64 " times in %" PRIu64 " ms, %" PRIu64
+                " elements moved, %" PRIu32 " live after last collection", pool_stats->collections,
+                pool_stats->collect_nsec / 1000000, pool_stats->moved, pool_stats->live);
+        } else if (gc == u6a_vm_gc_deferred) {
+            u6a_info_verbose(info_runtime, "zero count table reconciled %" PRIu64 " times in %" PRIu64
+                " ms, %" PRIu64 " elements freed", pool_stats->collections, pool_stats->collect_nsec / 1000000,
+                pool_stats->freed);
+        }
+        if (hash_cons) {
+            u6a_info_verbose(info_runtime, "objects shared by %" PRIu64 " allocations", pool_stats->shared);
+        }
+        if (memo) {
+            const struct u6a_vm_memo_stats* memo_stats = u6a_vm_memo_stats();
+            u6a_info_verbose(info_runtime, "pure applications cached %" PRIu64 " times, missed %" PRIu64
+                " times, %" PRIu64 " results recorded, %" PRIu64 " evicted", memo_stats->hits, memo_stats->misses,
+                memo_stats->records, memo_stats->evictions);
+        }
+    }
+    u6a_vm_stack_destroy();
+    u6a_vm_memo_destroy();
+#ifdef HAVE_JIT
+    u6a_vm_jit_destroy();
+#endif
+    u6a_vm_pool_destroy();
+    if (bc_image_mapped) {
+        munmap(bc_image, bc_image_size);
+    } else {
+        free(bc_image);
+    }
+    bc_image = NULL;
+    bc_image_mapped = false;
     text = NULL;
     rodata = NULL;
+    native_run = NULL;
 }
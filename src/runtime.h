@@ -21,17 +21,29 @@
 #define U6A_RUNTIME_H_
 
 #include "common.h"
+#include "vm_defs.h"
+#include "vm_jit.h"
 
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
 
 struct u6a_runtime_options {
-    FILE*    istream;
-    char*    file_name;
-    uint32_t stack_segment_size;
-    uint32_t pool_size;
-    bool     force_exec;
+    FILE*           istream;
+    char*           file_name;
+    const struct u6a_runtime_native* native;
+    uint32_t        stack_segment_size;
+    uint32_t        stack_segment_max_size;
+    uint32_t        pool_size;
+    uint32_t        pool_max_size;
+    bool            pool_huge_pages;
+    enum u6a_vm_gc  gc;
+    bool            hash_cons;
+    bool            memo;
+    bool            jit;
+    uint32_t        output_buffer_size;
+    bool            output_thread;
+    bool            force_exec;
 };
 
 bool
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include "u6a.h"
 #include "logging.h"
 #include "vm_defs.h"
 #include "runtime.h"
@@ -32,11 +33,12 @@
 
 #define PARSE_UINT_OPT(opt, min_val, max_val)                            \
     errno = 0;                                                           \
-    (opt) = strtoul(optarg, NULL, 10);                                   \
-    if (UNLIKELY(errno)) {                                               \
+    uint_opt = strtoul(optarg, NULL, 10);                                \
+    if (UNLIKELY(errno || uint_opt > UINT32_MAX)) {                      \
         u6a_err_invalid_uint(err_toplevel, optarg);                      \
         return false;                                                    \
     }                                                                    \
+    (opt) = uint_opt;                                                    \
     if (UNLIKELY((opt) < (min_val) || (opt) > (max_val))) {              \
         u6a_err_uint_not_in_range(err_toplevel, min_val, max_val, opt);  \
         return false;                                                    \
@@ -44,6 +46,7 @@
 
 struct arg_options {
     struct u6a_runtime_options runtime;
+    FILE*                      input_file;
     bool                       print_info;
     bool                       print_only;
 };
@@ -56,24 +59,41 @@ arg_options_destroy(struct arg_options* options) {
     if (options->runtime.istream && options->runtime.istream != stdin) {
         fclose(options->runtime.istream);
     }
+    if (options->input_file) {
+        fclose(options->input_file);
+    }
 }
 
 static bool
-process_options(struct arg_options* options, int argc, char** argv) {
+process_options(struct arg_options* options, int argc, char** argv, const struct u6a_runtime_native* native) {
     static const struct option long_opts[] = {
-        { "stack-segment-size", required_argument, NULL, 's' },
-        { "pool-size",          required_argument, NULL, 'p' },
-        { "info",               no_argument,       NULL, 'i' },
-        { "force",              no_argument,       NULL, 'f' },
-        { "help",               no_argument,       NULL, 'H' },
-        { "version",            no_argument,       NULL, 'V' },
+        { "stack-segment-size",     required_argument, NULL, 's' },
+        { "stack-segment-max-size", required_argument, NULL, 'S' },
+        { "pool-size",              required_argument, NULL, 'p' },
+        { "pool-max-size",          required_argument, NULL, 'P' },
+        { "pool-huge-pages",        no_argument,       NULL, 'T' },
+        { "gc",                     required_argument, NULL, 'g' },
+        { "hash-cons",              no_argument,       NULL, 'C' },
+        { "memo",                   no_argument,       NULL, 'M' },
+        { "jit",                    no_argument,       NULL, 'J' },
+        { "output-buffer-size",     required_argument, NULL, 'b' },
+        { "output-thread",          no_argument,       NULL, 't' },
+        { "input",                  required_argument, NULL, 'I' },
+        { "info",                   no_argument,       NULL, 'i' },
+        { "force",                  no_argument,       NULL, 'f' },
+        { "verbose",                no_argument,       NULL, 'v' },
+        { "help",                   no_argument,       NULL, 'H' },
+        { "version",                no_argument,       NULL, 'V' },
         { 0, 0, 0, 0 }
     };
     options->runtime.stack_segment_size = U6A_VM_DEFAULT_STACK_SEGMENT_SIZE;
     options->runtime.pool_size = U6A_VM_DEFAULT_POOL_SIZE;
+    options->runtime.pool_max_size = U6A_VM_MAX_POOL_SIZE;
+    options->runtime.output_buffer_size = U6A_VM_DEFAULT_OUTPUT_BUFFER_SIZE;
     options->print_info = false;
+    unsigned long uint_opt;
     while (true) {
-        int result = getopt_long(argc, argv, "s:p:ifHV", long_opts, NULL);
+        int result = getopt_long(argc, argv, "s:S:p:P:Tg:CMJb:tI:ifvHV", long_opts, NULL);
         if (result == -1) {
             break;
         }
@@ -82,22 +102,89 @@ process_options(struct arg_options* options, int argc, char** argv) {
                 PARSE_UINT_OPT(options->runtime.stack_segment_size,
                     U6A_VM_MIN_STACK_SEGMENT_SIZE, U6A_VM_MAX_STACK_SEGMENT_SIZE);
                 break;
+            case 'S':
+                PARSE_UINT_OPT(options->runtime.stack_segment_max_size,
+                    U6A_VM_MIN_STACK_SEGMENT_SIZE, U6A_VM_MAX_STACK_SEGMENT_SIZE);
+                break;
             case 'p':
                 PARSE_UINT_OPT(options->runtime.pool_size, U6A_VM_MIN_POOL_SIZE, U6A_VM_MAX_POOL_SIZE);
                 break;
+            case 'P':
+                PARSE_UINT_OPT(options->runtime.pool_max_size, U6A_VM_MIN_POOL_SIZE, U6A_VM_MAX_POOL_SIZE);
+                break;
+            case 'T':
+                options->runtime.pool_huge_pages = true;
+                break;
+            case 'g':
+                if (strcmp(optarg, "refcount") == 0) {
+                    options->runtime.gc = u6a_vm_gc_refcount;
+                } else if (strcmp(optarg, "tracing") == 0) {
+                    options->runtime.gc = u6a_vm_gc_tracing;
+                } else if (strcmp(optarg, "deferred") == 0) {
+                    options->runtime.gc = u6a_vm_gc_deferred;
+                } else {
+                    u6a_err_invalid_option_arg(err_toplevel, "gc", optarg);
+                    return false;
+                }
+                break;
+            case 'C':
+                options->runtime.hash_cons = true;
+                break;
+            case 'M':
+                options->runtime.memo = true;
+                break;
+            case 'J':
+#ifdef HAVE_JIT
+                options->runtime.jit = true;
+                break;
+#else
+                u6a_err_custom(err_toplevel, "JIT not supported by this build");
+                return false;
+#endif
+            case 'b':
+                PARSE_UINT_OPT(options->runtime.output_buffer_size,
+                    U6A_VM_MIN_OUTPUT_BUFFER_SIZE, U6A_VM_MAX_OUTPUT_BUFFER_SIZE);
+                break;
+            case 't':
+#ifdef HAVE_OUTPUT_THREAD
+                options->runtime.output_thread = true;
+                break;
+#else
+                u6a_err_custom(err_toplevel, "output thread not supported by this build");
+                return false;
+#endif
+            case 'I':
+                if (UNLIKELY(options->input_file)) {
+                    fclose(options->input_file);
+                }
+                options->input_file = fopen(optarg, "r");
+                if (UNLIKELY(options->input_file == NULL)) {
+                    u6a_err_cannot_open_file(err_toplevel, optarg);
+                    return false;
+                }
+                break;
             case 'i':
                 options->print_info = true;
                 break;
             case 'f':
                 options->runtime.force_exec = true;
                 break;
+            case 'v':
+                u6a_logging_verbose(true);
+                break;
             case 'H':
-                printf("Usage: u6a [options] bytecode-file\n\n"
-                       "Runtime for the Unlambda programming language.\n"
-                       "See \"man u6a\" for details.\n");
+                if (native) {
+                    printf("Usage: %s [options]\n\n"
+                           "Unlambda program compiled by u6ac, taking runtime options of u6a.\n"
+                           "See \"man u6a\" for details.\n", argv[0]);
+                } else {
+                    printf("Usage: u6a [options] bytecode-file\n\n"
+                           "Runtime for the Unlambda programming language.\n"
+                           "See \"man u6a\" for details.\n");
+                }
                 options->print_only = true;
                 break;
-            case 'v':
+            case 'V':
                 printf("%d.%d.%d\n", U6A_VER_MAJOR, U6A_VER_MINOR, U6A_VER_PATCH);
                 options->print_only = true;
                 break;
@@ -110,6 +197,29 @@ process_options(struct arg_options* options, int argc, char** argv) {
     if (UNLIKELY(options->print_only)) {
         return true;
     }
+    if (UNLIKELY(options->runtime.memo && options->runtime.gc != u6a_vm_gc_refcount)) {
+        // Cached results are held by reference counts
+        u6a_err_custom(err_toplevel, "option --memo requires --gc=refcount");
+        return false;
+    }
+    if (UNLIKELY(options->runtime.memo && options->runtime.jit)) {
+        u6a_err_custom(err_toplevel, "option --memo cannot be used along with --jit");
+        return false;
+    }
+    if (native) {
+        // Program is compiled into the executable, which takes no bytecode file
+        if (UNLIKELY(options->print_info || optind != argc)) {
+            u6a_err_custom(err_toplevel, "option --info and bytecode file not applicable to native program");
+            return false;
+        }
+        if (UNLIKELY(native->run && (options->runtime.jit || options->runtime.memo))) {
+            u6a_err_custom(err_toplevel, "options --jit and --memo not applicable to program compiled into C code");
+            return false;
+        }
+        options->runtime.native = native;
+        options->runtime.file_name = argv[0];
+        return true;
+    }
     if (UNLIKELY(optind == argc)) {
         u6a_err_no_input_file(err_toplevel);
         return false;
@@ -132,11 +242,20 @@ process_options(struct arg_options* options, int argc, char** argv) {
     return true;
 }
 
-int main(int argc, char** argv) {
+int
+u6a_main(int argc, char** argv, const struct u6a_runtime_native* native) {
     struct arg_options options = { 0 };
     int exit_code = 0;
     u6a_logging_init(argv[0]);
-    if (UNLIKELY(!process_options(&options, argc, argv))) {
+    // Output of the Unlambda program goes to STDOUT
+    u6a_logging_verbose_to_stderr(true);
+    if (native && UNLIKELY(native->layout != U6A_NATIVE_LAYOUT)) {
+        // Rest of the program can't be read safely
+        u6a_err_custom(err_toplevel, "program compiled against another version of u6a_native.h, recompile it");
+        exit_code = EC_ERR_INIT;
+        goto terminate;
+    }
+    if (UNLIKELY(!process_options(&options, argc, argv, native))) {
         exit_code = EC_ERR_OPTIONS;
         goto terminate;
     }
@@ -153,7 +272,8 @@ int main(int argc, char** argv) {
         exit_code = EC_ERR_INIT;
         goto terminate;
     }
-    union u6a_vm_var exec_result = u6a_runtime_execute(stdin, stdout);
+    FILE* input_stream = options.input_file ? options.input_file : stdin;
+    union u6a_vm_var exec_result = u6a_runtime_execute(input_stream, stdout);
     if (UNLIKELY(exec_result.ptr == NULL)) {
         exit_code = EC_ERR_RUNTIME;
         goto terminate;
@@ -0,0 +1,31 @@
+/*
+ * u6a.h - Unlambda runtime CLI definitions
+ * 
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef U6A_U6A_H_
+#define U6A_U6A_H_
+
+#include "common.h"
+#include "runtime.h"
+
+// Runs the Unlambda runtime with the given arguments. Bytecode is loaded from the file given in arguments,
+// unless a natively compiled program is given.
+int
+u6a_main(int argc, char** argv, const struct u6a_runtime_native* native);
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * u6a_native.h - Definitions shared by the runtime library and programs compiled into C
+ *
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef U6A_U6A_NATIVE_H_
+#define U6A_U6A_NATIVE_H_
+
+// This header is installed along with libu6a, and included by C code written by u6ac, thus depends on
+// nothing else in the source tree.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Revision of the definitions below, to be bumped whenever any of them changes
+#define U6A_NATIVE_REVISION 1
+
+// Stamp of a native program, telling whether it is laid out the same way as the runtime expects
+#define U6A_NATIVE_LAYOUT                                                \
+    ( (uint32_t)U6A_NATIVE_REVISION << 24                                \
+    | (uint32_t)sizeof(struct u6a_vm_ins) << 16                          \
+    | (uint32_t)sizeof(struct u6a_vm_var_fn) << 8                        \
+    | (uint32_t)sizeof(struct u6a_runtime_native) )
+
+struct u6a_token {
+    uint8_t fn;
+    uint8_t ch;
+};
+
+// Operands are offsets into text or rodata, never pointers, so that text can be executed as stored
+struct u6a_vm_ins {
+    uint8_t  opcode;
+    uint8_t  opcode_ex;
+    uint16_t reserved_;
+    union {
+        uint32_t offset;
+        struct {
+            struct u6a_token first;
+            struct u6a_token second;
+        } fn;
+    } operand;
+};
+
+struct u6a_vm_var_fn {
+    struct u6a_token token;
+    uint16_t         reserved_;
+    uint32_t         ref;
+};
+
+#define U6A_VM_JIT_EXIT    UINT32_MAX         /* program terminated by `e` */
+#define U6A_VM_JIT_ERROR ( UINT32_MAX - 1 )
+
+// Outcome of native code, or of a call back into the runtime
+struct u6a_vm_jit_ret {
+    struct u6a_vm_var_fn acc;
+    uint32_t             next;                /* offset of instruction to execute next, or U6A_VM_JIT_* */
+};
+
+typedef struct u6a_vm_jit_ret (*u6a_vm_jit_apply_fn)(struct u6a_vm_var_fn func, struct u6a_vm_var_fn arg,
+                                                     uint32_t ins);
+
+// Work which native code leaves to the runtime, each taking offset of the current instruction
+struct u6a_vm_jit_ops {
+    const u6a_vm_jit_apply_fn* apply;                               /* indexed by function being applied */
+    struct u6a_vm_jit_ret    (*delay_top)(uint32_t ins);            /* `d`<top><top> */
+    struct u6a_vm_jit_ret    (*invalid)(uint32_t ins);
+};
+
+// Program compiled ahead of time into C by u6ac, which is linked against the runtime
+struct u6a_runtime_native {
+    uint32_t                  layout;         /* U6A_NATIVE_LAYOUT, checked before anything else is read */
+    uint8_t                   ver_major;
+    uint8_t                   ver_minor;
+    uint32_t                  features;
+    const struct u6a_vm_ins*  text;
+    uint32_t                  text_len;
+    const char*               rodata;
+    uint32_t                  rodata_len;
+    // Runs from the given offset of text, leaving applications to the runtime as the JIT does. Bundled bytecode
+    // has none, and is interpreted instead.
+    struct u6a_vm_jit_ret   (*run)(const struct u6a_vm_jit_ops* ops, uint32_t offset);
+};
+
+// Functions of the runtime called by native code directly
+
+bool
+u6a_vm_stack_push1(struct u6a_vm_var_fn v0);
+
+bool
+u6a_vm_stack_pop(struct u6a_vm_var_fn* v0);
+
+bool
+u6a_vm_stack_xch(struct u6a_vm_var_fn* v0);
+
+void
+u6a_vm_output_putc(char ch);
+
+int
+u6a_main(int argc, char** argv, const struct u6a_runtime_native* native);
+
+#endif
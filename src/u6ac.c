@@ -20,7 +20,9 @@
 #include "logging.h"
 #include "lexer.h"
 #include "parser.h"
+#include "optimizer.h"
 #include "codegen.h"
+#include "bundle.h"
 
 #include <unistd.h>
 #include <stdlib.h>
@@ -31,6 +33,8 @@
 #define EC_ERR_LEX      2
 #define EC_ERR_PARSE    3
 #define EC_ERR_CODEGEN  4
+#define EC_ERR_BUNDLE   5
+#define EC_ERR_OPTIMIZE 6
 
 struct arg_options {
     FILE* input_file;
@@ -38,8 +42,10 @@ struct arg_options {
     FILE* output_file;
     char* output_file_prefix;
     char* output_file_name;
-    bool  optimize_const;
+    char* bundle_file_name;
+    char* default_file_name;
     bool  print_only;
+    enum u6a_codegen_target target;
 };
 
 static const char* err_toplevel = "error";
@@ -57,6 +63,7 @@ arg_options_destroy(struct arg_options* options, bool delete_output_file) {
     if (delete_output_file && not_using_stdout && options->output_file_name) {
         remove(options->output_file_name);
     }
+    free(options->default_file_name);
 }
 
 static bool
@@ -66,16 +73,18 @@ process_options(struct arg_options* options, int argc, char** argv) {
         { "add-prefix",  optional_argument, NULL, 'p' },
         { "verbose",     no_argument,       NULL, 'v' },
         { "syntax-only", no_argument,       NULL, 's' },
+        { "emit",        required_argument, NULL, 'e' },
+        { "bundle",      no_argument,       NULL, 'b' },
         { "help",        no_argument,       NULL, 'H' },
         { "version",     no_argument,       NULL, 'V' },
         { 0, 0, 0, 0 }
     };
-    options->optimize_const = false;
     bool syntax_only = false;
+    bool bundle = false;
     bool verbose = false;
     char optimize_level = '1';
     while (true) {
-        int result = getopt_long(argc, argv, "o:O::vHV", long_opts, NULL);
+        int result = getopt_long(argc, argv, "o:O::e:f:vHV", long_opts, NULL);
         if (result == -1) {
             break;
         }
@@ -88,12 +97,42 @@ process_options(struct arg_options* options, int argc, char** argv) {
                 break;
             case 'O':
                 optimize_level = optarg ? optarg[0] : '1';
+                if (UNLIKELY(optimize_level < '0' || optimize_level > '0' + U6A_OPT_MAX_LEVEL
+                             || (optarg && optarg[1]))) {
+                    u6a_err_invalid_option_arg(err_toplevel, "O", optarg);
+                    return false;
+                }
+                break;
+            case 'f':
+                if (strncmp(optarg, "no-", 3) == 0) {
+                    if (UNLIKELY(!u6a_optimize_set_pass(optarg + 3, false))) {
+                        u6a_err_invalid_option_arg(err_toplevel, "f", optarg);
+                        return false;
+                    }
+                } else if (UNLIKELY(!u6a_optimize_set_pass(optarg, true))) {
+                    u6a_err_invalid_option_arg(err_toplevel, "f", optarg);
+                    return false;
+                }
+                break;
             case 'p':
                 if (UNLIKELY(options->output_file_prefix)) {
                     break;
                 }
                 options->output_file_prefix = optarg ? optarg : "#!/usr/bin/env u6a\n";
                 break;
+            case 'e':
+                if (strcmp(optarg, "bc") == 0) {
+                    options->target = u6a_ct_bc;
+                } else if (strcmp(optarg, "c") == 0) {
+                    options->target = u6a_ct_c;
+                } else {
+                    u6a_err_invalid_option_arg(err_toplevel, "emit", optarg);
+                    return false;
+                }
+                break;
+            case 'b':
+                bundle = true;
+                break;
             case 'v':
                 verbose = true;
                 break;
@@ -119,6 +158,18 @@ process_options(struct arg_options* options, int argc, char** argv) {
     if (UNLIKELY(options->print_only)) {
         return true;
     }
+    if (bundle) {
+        if (UNLIKELY(options->target != u6a_ct_bc)) {
+            u6a_err_custom(err_toplevel, "option --bundle cannot be used along with --emit=c");
+            return false;
+        }
+        options->target = u6a_ct_bundle;
+    }
+    if (UNLIKELY(options->target != u6a_ct_bc && options->output_file_prefix)) {
+        // A prefix such as "#!" line does not make valid C code
+        u6a_err_custom(err_toplevel, "option --add-prefix only applicable to bytecode");
+        return false;
+    }
     // Input file
     if (UNLIKELY(optind == argc)) {
         u6a_err_no_input_file(err_toplevel);
@@ -149,16 +200,32 @@ process_options(struct arg_options* options, int argc, char** argv) {
             if (options->input_file == stdin) {
                 goto write_to_stdout;
             } else {
-                if (UNLIKELY(file_name_size + 3 > PATH_MAX - 1)) {
-                    u6a_err_path_too_long(err_toplevel, PATH_MAX - 1, file_name_size + 3);
+                static const char* const suffixes[] = {
+                    [u6a_ct_bc]     = ".bc",
+                    [u6a_ct_c]      = ".c",
+                    [u6a_ct_bundle] = ".out"
+                };
+                const char* suffix = suffixes[options->target];
+                const uint32_t name_size = file_name_size + strlen(suffix);
+                if (UNLIKELY(name_size > PATH_MAX - 1)) {
+                    u6a_err_path_too_long(err_toplevel, PATH_MAX - 1, name_size);
+                    return false;
+                }
+                options->output_file_name = malloc((name_size + 1) * sizeof(char));
+                if (UNLIKELY(options->output_file_name == NULL)) {
+                    u6a_err_bad_alloc(err_toplevel, name_size + 1);
                     return false;
                 }
-                options->output_file_name = malloc((file_name_size + 4) * sizeof(char));
                 strcpy(options->output_file_name, options->input_file_name);
-                strcpy(options->output_file_name + file_name_size, ".bc\0");
+                strcpy(options->output_file_name + file_name_size, suffix);
+                options->default_file_name = options->output_file_name;
             }
         } else if (strlen(options->output_file_name) == 1 && options->output_file_name[0] == '-') {
             write_to_stdout:
+            if (UNLIKELY(bundle)) {
+                u6a_err_custom(err_toplevel, "cannot write executable to STDOUT");
+                return false;
+            }
             if (verbose) {
                 u6a_err_custom(err_toplevel, "cannot write to STDOUT on verbose mode");
                 return false;
@@ -166,6 +233,14 @@ process_options(struct arg_options* options, int argc, char** argv) {
             options->output_file = stdout;
             options->output_file_name = "STDOUT";
         }
+        if (bundle) {
+            // C code holding bytecode is written to a temporary file, which is removed once linked
+            options->bundle_file_name = options->output_file_name;
+            options->output_file = u6a_bundle_tmp_file(&options->output_file_name);
+            if (UNLIKELY(options->output_file == NULL)) {
+                return false;
+            }
+        }
         if (options->output_file == NULL) {
             options->output_file = fopen(options->output_file_name, "w");
             if (options->output_file == NULL) {
@@ -174,9 +249,7 @@ process_options(struct arg_options* options, int argc, char** argv) {
             }
         }
     }
-    if (optimize_level > '0') {
-        options->optimize_const = true;
-    }
+    u6a_optimize_init(optimize_level - '0');
     u6a_logging_verbose(verbose);
     return true;
 }
@@ -208,15 +281,30 @@ main(int argc, char** argv) {
     if (UNLIKELY(options.output_file == NULL)) {
         goto terminate;
     }
-    u6a_codegen_init(options.output_file, options.output_file_name, options.optimize_const);
+    uint32_t ast_len = token_len + 2;
+    if (UNLIKELY(!u6a_optimize_ast(ast_arr, &ast_len))) {
+        exit_code = EC_ERR_OPTIMIZE;
+        goto terminate;
+    }
+    u6a_codegen_init(options.output_file, options.output_file_name, options.target);
     if (UNLIKELY(!u6a_write_prefix(options.output_file_prefix))) {
         exit_code = EC_ERR_CODEGEN;
         goto terminate;
     }
-    if (UNLIKELY(!u6a_codegen(ast_arr, token_len + 2))) {
+    if (UNLIKELY(!u6a_codegen(ast_arr, ast_len))) {
         exit_code = EC_ERR_CODEGEN;
         goto terminate;
     }
+    if (options.target == u6a_ct_bundle) {
+        fclose(options.output_file);
+        options.output_file = NULL;
+        if (UNLIKELY(!u6a_bundle_link(options.output_file_name, options.bundle_file_name, argv[0]))) {
+            exit_code = EC_ERR_BUNDLE;
+        }
+        remove(options.output_file_name);
+        free(options.output_file_name);
+        options.output_file_name = NULL;
+    }
 
     terminate:
     arg_options_destroy(&options, exit_code);
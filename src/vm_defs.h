@@ -30,10 +30,13 @@
 
 enum u6a_vm_opcode {
     u6a_vo_placeholder_,
-    u6a_vo_app = U6A_VM_OP_APPLY,
-    u6a_vo_la,
+    u6a_vo_app = U6A_VM_OP_APPLY,                     /* `XY         */
+    u6a_vo_la,                                        /* `<top><acc> */
+    u6a_vo_app_ia,                                    /* `X<acc>     */
+    u6a_vo_app_ai,                                    /* `<acc>Y     */
     u6a_vo_sa = U6A_VM_OP_OFFSET,
     u6a_vo_del,
+    u6a_vo_call,                                      /* `j` pushed, returned to by `la` */
     u6a_vo_lc = U6A_VM_OP_OFFSET | U6A_VM_OP_EXTENTED,
     u6a_vo_xch = U6A_VM_OP_INTERNAL
 };
@@ -49,6 +52,7 @@ enum u6a_vm_opcode_ex {
 #define U6A_VM_FN_REF      ( 1 << 5 )
 #define U6A_VM_FN_PROMISE  ( 1 << 6 )
 #define U6A_VM_FN_INTERNAL ( 1 << 7 )
+#define U6A_VM_FN_IMM      ( U6A_VM_FN_INTERNAL | U6A_VM_FN_CHAR )
 
 enum u6a_vm_fn {
     u6a_vf_placeholder_,
@@ -61,32 +65,40 @@ enum u6a_vm_fn {
     u6a_vf_s1,                                        /* `sX        */
     u6a_vf_s2,                                        /* ``sXY      */
     u6a_vf_c1,                                        /* `cX        */
+    u6a_vf_m,                                         /* (memoize)  */
     u6a_vf_d1_s = U6A_VM_FN_PROMISE | U6A_VM_FN_REF,  /* `d`XZ      */
     u6a_vf_d1_c,                                      /* `dX        */
     u6a_vf_d1_d = U6A_VM_FN_PROMISE,                  /* `dF        */
     u6a_vf_j = U6A_VM_FN_INTERNAL,                    /* (jump)     */
     u6a_vf_f,                                         /* (finalize) */
-    u6a_vf_p                                          /* (print)    */
+    u6a_vf_p,                                         /* (print)    */
+    u6a_vf_k1_imm = U6A_VM_FN_IMM,                    /* `kX        */
+    u6a_vf_s1_imm,                                    /* `sX        */
+    u6a_vf_s2_imm,                                    /* ``sXY      */
+    u6a_vf_d1_c_imm                                   /* `dX        */
 };
 
-struct u6a_vm_ins {
-    uint8_t  opcode;
-    uint8_t  opcode_ex;
-    uint16_t reserved_;
-    union {
-        uint32_t offset;
-        struct {
-            struct u6a_token first;
-            struct u6a_token second;
-        } fn;
-    } operand;
-};
+// Partial applications over primitive functions are not allocated in the pool. Tokens of the operands are
+// packed into the ref instead, 16 bits each.
+#define U6A_VM_FN_IS_PRIM(fn_) ( (fn_) < U6A_VM_FN_REF )
+#define U6A_VM_IMM(token_)     ( (uint32_t)(token_).fn | (uint32_t)(token_).ch << 8 )
 
-struct u6a_vm_var_fn {
-    struct u6a_token token;
-    uint16_t         reserved_;
-    uint32_t         ref;
-};
+// Functions which neither perform I/O nor capture or alter control flow, on whatever they are applied to
+#define U6A_VM_FN_IS_PURE(fn_) ( (fn_) >= u6a_vf_k && (fn_) <= u6a_vf_v )
+
+// Text segment begins with the instructions evaluating ``XZ`YZ, to which application of ``sXY jumps
+#define U6A_VM_TEXT_SUBST                    \
+    {                                        \
+        { .opcode = u6a_vo_la  },            \
+        { .opcode = u6a_vo_xch },            \
+        { .opcode = u6a_vo_la  },            \
+        { .opcode = u6a_vo_la  },            \
+        { .opcode = u6a_vo_la  }             \
+    }
+#define U6A_VM_TEXT_SUBST_LEN 5
+
+// Strings in rodata segment are prefixed with their length, and aligned to the length field
+#define U6A_VM_RODATA_STR_ALIGN sizeof(uint32_t)
 
 #define U6A_VM_VAR_FN_REF(fn_, ref_) (struct u6a_vm_var_fn) { .token.fn = (fn_), .ref = (ref_) }
 
@@ -106,9 +118,27 @@ struct u6a_vm_var_tuple {
 #define U6A_VM_DEFAULT_STACK_SEGMENT_SIZE   256
 #define U6A_VM_MIN_STACK_SEGMENT_SIZE       64
 #define U6A_VM_MAX_STACK_SEGMENT_SIZE     ( 1024 * 1024 )
+#define U6A_VM_STACK_SEGMENT_CACHE_SIZE     4
+#define U6A_VM_STACK_MAX_UNWIND_SEGMENTS    16
+
+enum u6a_vm_gc {
+    u6a_vm_gc_refcount,                               /* objects freed as soon as they are no longer referred to */
+    u6a_vm_gc_tracing,                                /* live objects marked and compacted when pool fills up */
+    u6a_vm_gc_deferred                                /* refcounting which skips references from stack */
+};
+
+#define U6A_VM_ZCT_SIZE                   ( 64 * 1024 )
+#define U6A_VM_HASH_CONS_SIZE             ( 64 * 1024 )
+#define U6A_VM_MEMO_SIZE                  ( 64 * 1024 )
 
 #define U6A_VM_DEFAULT_POOL_SIZE          ( 1024 * 1024 )
 #define U6A_VM_MIN_POOL_SIZE                16
-#define U6A_VM_MAX_POOL_SIZE              ( 16 * 1024 * 1024 )
+#define U6A_VM_MAX_POOL_SIZE                UINT32_MAX
+
+#define U6A_VM_DEFAULT_OUTPUT_BUFFER_SIZE ( 64 * 1024 )
+#define U6A_VM_MIN_OUTPUT_BUFFER_SIZE       1
+#define U6A_VM_MAX_OUTPUT_BUFFER_SIZE     ( 64 * 1024 * 1024 )
+
+#define U6A_VM_INPUT_BUFFER_SIZE          ( 64 * 1024 )
 
 #endif
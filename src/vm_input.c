@@ -0,0 +1,141 @@
+/*
+ * vm_input.c - Unlambda VM input buffer
+ * 
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "vm_input.h"
+#include "vm_defs.h"
+#include "logging.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Characters in [cursor, limit) are ready to be read. They come either from the read-ahead buffer,
+// or from a read-only mapping of the input file.
+static const char* cursor;
+static const char* limit;
+static char*       buffer;
+static void*       map_addr;
+static size_t      map_len;
+static off_t       map_end;
+static int         input_fd;
+static FILE*       input_file;
+static bool        eof;
+
+static const char* err_stage;
+
+static inline bool
+map_input(off_t offset) {
+    struct stat st;
+    if (fstat(input_fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size <= offset) {
+        return false;
+    }
+    map_len = st.st_size;
+    map_addr = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, input_fd, 0);
+    if (map_addr == MAP_FAILED) {
+        map_addr = NULL;
+        return false;
+    }
+    madvise(map_addr, map_len, MADV_SEQUENTIAL);
+    map_end = st.st_size;
+    cursor = (const char*)map_addr + offset;
+    limit = (const char*)map_addr + map_len;
+    return true;
+}
+
+static int
+refill() {
+    if (input_file) {
+        return fgetc(input_file);
+    }
+    if (eof) {
+        return EOF;
+    }
+    if (map_addr) {
+        // The file may have grown since it was mapped, continue with plain reads
+        munmap(map_addr, map_len);
+        map_addr = NULL;
+        if (lseek(input_fd, map_end, SEEK_SET) == -1) {
+            eof = true;
+            return EOF;
+        }
+    }
+    ssize_t read_len;
+    do {
+        read_len = read(input_fd, buffer, U6A_VM_INPUT_BUFFER_SIZE);
+    } while (UNLIKELY(read_len == -1 && errno == EINTR));
+    if (read_len <= 0) {
+        // End of file is sticky, just like stdio
+        eof = true;
+        return EOF;
+    }
+    cursor = buffer;
+    limit = buffer + read_len;
+    return (unsigned char)*cursor++;
+}
+
+bool
+u6a_vm_input_init(FILE* stream, bool stream_used, const char* err_stage_) {
+    err_stage = err_stage_;
+    cursor = limit = NULL;
+    eof = false;
+    if (stream_used) {
+        // Characters may already be buffered by stdio, keep reading through it
+        input_file = stream;
+        return true;
+    }
+    input_file = NULL;
+    input_fd = fileno(stream);
+    buffer = malloc(U6A_VM_INPUT_BUFFER_SIZE);
+    if (UNLIKELY(buffer == NULL)) {
+        u6a_err_bad_alloc(err_stage, U6A_VM_INPUT_BUFFER_SIZE);
+        return false;
+    }
+    const off_t offset = lseek(input_fd, 0, SEEK_CUR);
+    if (offset != -1) {
+        map_input(offset);
+    }
+    return true;
+}
+
+U6A_HOT int
+u6a_vm_input_getc() {
+    if (LIKELY(cursor < limit)) {
+        return (unsigned char)*cursor++;
+    }
+    return refill();
+}
+
+bool
+u6a_vm_input_buffered() {
+    return cursor < limit;
+}
+
+void
+u6a_vm_input_destroy() {
+    if (map_addr) {
+        munmap(map_addr, map_len);
+        map_addr = NULL;
+    }
+    free(buffer);
+    buffer = NULL;
+    cursor = limit = NULL;
+}
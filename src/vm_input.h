@@ -0,0 +1,40 @@
+/*
+ * vm_input.h - Unlambda VM input buffer definitions
+ * 
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef U6A_VM_INPUT_H_
+#define U6A_VM_INPUT_H_
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+bool
+u6a_vm_input_init(FILE* stream, bool stream_used, const char* err_stage);
+
+int
+u6a_vm_input_getc();
+
+bool
+u6a_vm_input_buffered();
+
+void
+u6a_vm_input_destroy();
+
+#endif
@@ -0,0 +1,407 @@
+/*
+ * vm_jit.c - Unlambda VM native code compiler
+ *
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "vm_jit.h"
+#include "vm_stack.h"
+#include "vm_output.h"
+#include "logging.h"
+
+#ifdef HAVE_JIT
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Each instruction is translated into a fixed template of x86-64 code, in the order of text. Operands are
+// folded into the code, so that applications of known functions to known values are done at compile time.
+//
+// Within native code, acc is kept in r12, rbx points to the table of native addresses of instructions, and r13
+// to the table of functions applying each kind of function. Applications other than the trivial ones are left
+// to the runtime, which returns acc in rax, along with offset of the instruction to execute next in edx. When
+// it is not the following one, native code jumps through the table, or returns when the offset is out of range.
+// Every instruction makes its own calls and jumps, so that their targets are predicted separately.
+
+#define JIT_STUBS_SIZE    96
+#define JIT_INS_MAX_SIZE  128
+
+static        uint8_t*               code;
+static        size_t                 code_size;
+static        uint8_t*               cursor;
+static        void**                 table;
+static        uint32_t               table_len;
+static        uint8_t*               stub_exit;
+static        uint8_t*               stub_error;
+static        uint8_t*               stub_transfer;
+static struct u6a_vm_jit_ret       (*entry)(void** table, uint32_t offset);
+static const struct u6a_vm_jit_ops*  ops;
+
+static struct u6a_vm_jit_stats stats;
+
+static const char* err_stage;
+
+#define EMIT(...)                                                              \
+    emit_bytes((const uint8_t[]) { __VA_ARGS__ }, sizeof((const uint8_t[]) { __VA_ARGS__ }))
+
+static inline void
+emit_bytes(const uint8_t* bytes, size_t len) {
+    memcpy(cursor, bytes, len);
+    cursor += len;
+}
+
+static inline void
+emit_u32(uint32_t value) {
+    memcpy(cursor, &value, sizeof(uint32_t));
+    cursor += sizeof(uint32_t);
+}
+
+static inline void
+emit_u64(uint64_t value) {
+    memcpy(cursor, &value, sizeof(uint64_t));
+    cursor += sizeof(uint64_t);
+}
+
+static inline void
+emit_rel32(const uint8_t* target) {
+    emit_u32((uint32_t)(target - (cursor + sizeof(uint32_t))));
+}
+
+static inline uint64_t
+jit_var(uint8_t fn, uint32_t ref) {
+    const struct u6a_vm_var_fn var = U6A_VM_VAR_FN_REF(fn, ref);
+    uint64_t bits;
+    memcpy(&bits, &var, sizeof(uint64_t));
+    return bits;
+}
+
+static inline uint64_t
+jit_token(struct u6a_token token) {
+    const struct u6a_vm_var_fn var = { .token = token };
+    uint64_t bits;
+    memcpy(&bits, &var, sizeof(uint64_t));
+    return bits;
+}
+
+static inline void
+jit_call(const void* func) {
+    EMIT(0x48, 0xB8);                                 /* mov rax, imm64 */
+    emit_u64((uint64_t)(uintptr_t)func);
+    EMIT(0xFF, 0xD0);                                 /* call rax */
+}
+
+// Takes result of a call back into the runtime
+static inline void
+jit_ret(uint32_t offset) {
+    EMIT(0x49, 0x89, 0xC4);                           /* mov r12, rax */
+    EMIT(0x81, 0xFA);                                 /* cmp edx, imm32 */
+    emit_u32(offset + 1);
+    EMIT(0x74, 0x11);                                 /* je rel8 */
+    EMIT(0x89, 0xD2);                                 /* mov edx, edx */
+    EMIT(0x81, 0xFA);                                 /* cmp edx, imm32 */
+    emit_u32(table_len);
+    EMIT(0x0F, 0x83);                                 /* jae stub_exit */
+    emit_rel32(stub_exit);
+    EMIT(0xFF, 0x24, 0xD3);                           /* jmp [rbx + rdx * 8] */
+}
+
+static inline void
+jit_jmp_ins(uint32_t offset) {
+    if (offset < table_len) {
+        EMIT(0xFF, 0xA3);                             /* jmp [rbx + disp32] */
+        emit_u32(offset * sizeof(void*));
+    } else {
+        EMIT(0xE9);                                   /* jmp stub_error */
+        emit_rel32(stub_error);
+    }
+}
+
+static inline void
+jit_mov_acc(uint64_t value) {
+    EMIT(0x49, 0xBC);                                 /* mov r12, imm64 */
+    emit_u64(value);
+}
+
+static inline void
+jit_putc(char ch) {
+    EMIT(0xBF);                                       /* mov edi, imm32 */
+    emit_u32((uint8_t)ch);
+    jit_call((const void*)u6a_vm_output_putc);
+}
+
+static inline uint8_t*
+jit_skip_if_not_d() {
+    EMIT(0x41, 0x80, 0xFC, u6a_vf_d);                 /* cmp r12b, imm8 */
+    EMIT(0x75, 0x00);                                 /* jne rel8 */
+    return cursor;
+}
+
+static inline void
+jit_skip_here(uint8_t* from) {
+    from[-1] = (uint8_t)(cursor - from);
+}
+
+// Applies a known function
+static inline void
+jit_apply(struct u6a_token func, uint64_t arg, bool arg_acc, uint32_t offset) {
+    EMIT(0x48, 0xBF);                                 /* mov rdi, imm64 */
+    emit_u64(jit_token(func));
+    if (arg_acc) {
+        EMIT(0x4C, 0x89, 0xE6);                       /* mov rsi, r12 */
+    } else {
+        EMIT(0x48, 0xBE);                             /* mov rsi, imm64 */
+        emit_u64(arg);
+    }
+    EMIT(0xBA);                                       /* mov edx, imm32 */
+    emit_u32(offset);
+    jit_call((const void*)ops->apply[func.fn]);
+    jit_ret(offset);
+}
+
+// Applies function in rdi to value in rsi
+static inline void
+jit_apply_dynamic(uint32_t offset) {
+    EMIT(0xBA);                                       /* mov edx, imm32 */
+    emit_u32(offset);
+    EMIT(0x40, 0x0F, 0xB6, 0xC7);                     /* movzx eax, dil */
+    EMIT(0x41, 0xFF, 0x54, 0xC5, 0x00);               /* call [r13 + rax * 8] */
+    jit_ret(offset);
+}
+
+static inline void
+jit_invalid(uint32_t offset) {
+    EMIT(0xBF);                                       /* mov edi, imm32 */
+    emit_u32(offset);
+    jit_call((const void*)ops->invalid);
+    jit_ret(offset);
+}
+
+static void
+jit_stubs() {
+    stub_exit = cursor;
+    EMIT(0x4C, 0x89, 0xE0);                           /* mov rax, r12 */
+    EMIT(0x48, 0x83, 0xC4, 0x10);                     /* add rsp, 16 */
+    EMIT(0x41, 0x5D);                                 /* pop r13 */
+    EMIT(0x41, 0x5C);                                 /* pop r12 */
+    EMIT(0x5B);                                       /* pop rbx */
+    EMIT(0xC3);                                       /* ret */
+    stub_error = cursor;
+    EMIT(0xBA);                                       /* mov edx, imm32 */
+    emit_u32(U6A_VM_JIT_ERROR);
+    EMIT(0xE9);                                       /* jmp stub_exit */
+    emit_rel32(stub_exit);
+    stub_transfer = cursor;
+    EMIT(0x89, 0xD2);                                 /* mov edx, edx */
+    EMIT(0x81, 0xFA);                                 /* cmp edx, imm32 */
+    emit_u32(table_len);
+    EMIT(0x0F, 0x83);                                 /* jae stub_exit */
+    emit_rel32(stub_exit);
+    EMIT(0xFF, 0x24, 0xD3);                           /* jmp [rbx + rdx * 8] */
+    entry = (struct u6a_vm_jit_ret (*)(void**, uint32_t))cursor;
+    EMIT(0x53);                                       /* push rbx */
+    EMIT(0x41, 0x54);                                 /* push r12 */
+    EMIT(0x41, 0x55);                                 /* push r13 */
+    EMIT(0x48, 0x83, 0xEC, 0x10);                     /* sub rsp, 16 */
+    EMIT(0x48, 0x89, 0xFB);                           /* mov rbx, rdi */
+    EMIT(0x49, 0xBD);                                 /* mov r13, imm64 */
+    emit_u64((uint64_t)(uintptr_t)ops->apply);
+    EMIT(0x45, 0x31, 0xE4);                           /* xor r12d, r12d */
+    EMIT(0x89, 0xF2);                                 /* mov edx, esi */
+    EMIT(0xE9);                                       /* jmp stub_transfer */
+    emit_rel32(stub_transfer);
+}
+
+static void
+jit_ins(const struct u6a_vm_ins* ins, uint32_t offset, bool promises, bool force_exec) {
+    const struct u6a_token first = ins->operand.fn.first;
+    const struct u6a_token second = ins->operand.fn.second;
+    uint8_t* skip;
+    switch (ins->opcode) {
+        case u6a_vo_app:
+            if (!U6A_VM_FN_IS_PRIM(second.fn)) {
+                jit_apply(first, jit_token(second), false, offset);
+            } else if (first.fn == u6a_vf_i) {
+                jit_mov_acc(jit_token(second));
+            } else if (first.fn == u6a_vf_k) {
+                jit_mov_acc(jit_var(u6a_vf_k1_imm, U6A_VM_IMM(second)));
+            } else if (first.fn == u6a_vf_s) {
+                jit_mov_acc(jit_var(u6a_vf_s1_imm, U6A_VM_IMM(second)));
+            } else if (first.fn == u6a_vf_d) {
+                jit_mov_acc(jit_var(u6a_vf_d1_c_imm, U6A_VM_IMM(second)));
+            } else if (first.fn == u6a_vf_v) {
+                jit_mov_acc(jit_var(u6a_vf_v, 0));
+            } else if (first.fn == u6a_vf_out) {
+                jit_putc(first.ch);
+                jit_mov_acc(jit_token(second));
+            } else {
+                jit_apply(first, jit_token(second), false, offset);
+            }
+            break;
+        case u6a_vo_app_ia:
+            if (first.fn == u6a_vf_i) {
+                // Leaves acc as is
+            } else if (first.fn == u6a_vf_out) {
+                jit_putc(first.ch);
+            } else {
+                jit_apply(first, 0, true, offset);
+            }
+            break;
+        case u6a_vo_app_ai:
+            EMIT(0x4C, 0x89, 0xE7);                   /* mov rdi, r12 */
+            EMIT(0x48, 0xBE);                         /* mov rsi, imm64 */
+            emit_u64(jit_token(second));
+            jit_apply_dynamic(offset);
+            break;
+        case u6a_vo_la:
+            EMIT(0x48, 0x89, 0xE7);                   /* mov rdi, rsp */
+            jit_call((const void*)u6a_vm_stack_pop);
+            EMIT(0x84, 0xC0);                         /* test al, al */
+            EMIT(0x0F, 0x84);                         /* je stub_error */
+            emit_rel32(stub_error);
+            EMIT(0x48, 0x8B, 0x3C, 0x24);             /* mov rdi, [rsp] */
+            EMIT(0x4C, 0x89, 0xE6);                   /* mov rsi, r12 */
+            jit_apply_dynamic(offset);
+            break;
+        case u6a_vo_sa:
+            if (promises) {
+                skip = jit_skip_if_not_d();
+                jit_mov_acc(jit_var(u6a_vf_d1_d, offset + 1));
+                jit_jmp_ins(ins->operand.offset);
+                jit_skip_here(skip);
+            }
+            EMIT(0x4C, 0x89, 0xE7);                   /* mov rdi, r12 */
+            jit_call((const void*)u6a_vm_stack_push1);
+            EMIT(0x84, 0xC0);                         /* test al, al */
+            EMIT(0x0F, 0x84);                         /* je stub_error */
+            emit_rel32(stub_error);
+            break;
+        case u6a_vo_del:
+            jit_mov_acc(jit_var(u6a_vf_d1_d, offset + 1));
+            jit_jmp_ins(ins->operand.offset);
+            break;
+        case u6a_vo_call:
+            EMIT(0x48, 0xBF);                         /* mov rdi, imm64 */
+            emit_u64(jit_var(u6a_vf_j, offset));
+            jit_call((const void*)u6a_vm_stack_push1);
+            EMIT(0x84, 0xC0);                         /* test al, al */
+            EMIT(0x0F, 0x84);                         /* je stub_error */
+            emit_rel32(stub_error);
+            jit_jmp_ins(ins->operand.offset);
+            break;
+        case u6a_vo_lc:
+            if (LIKELY(ins->opcode_ex == u6a_vo_ex_print)) {
+                jit_mov_acc(jit_var(u6a_vf_p, ins->operand.offset));
+            } else if (!force_exec) {
+                jit_invalid(offset);
+            }
+            break;
+        case u6a_vo_xch:
+            if (promises) {
+                skip = jit_skip_if_not_d();
+                EMIT(0xBF);                           /* mov edi, imm32 */
+                emit_u32(offset);
+                jit_call((const void*)ops->delay_top);
+                jit_ret(offset);
+                jit_jmp_ins(offset + 1);
+                jit_skip_here(skip);
+            }
+            EMIT(0x4C, 0x89, 0x24, 0x24);             /* mov [rsp], r12 */
+            EMIT(0x48, 0x89, 0xE7);                   /* mov rdi, rsp */
+            jit_call((const void*)u6a_vm_stack_xch);
+            EMIT(0x84, 0xC0);                         /* test al, al */
+            EMIT(0x0F, 0x84);                         /* je stub_error */
+            emit_rel32(stub_error);
+            EMIT(0x4C, 0x8B, 0x24, 0x24);             /* mov r12, [rsp] */
+            break;
+        default:
+            if (!force_exec) {
+                jit_invalid(offset);
+            }
+    }
+}
+
+bool
+u6a_vm_jit_init(const struct u6a_vm_ins* text, uint32_t text_len, const struct u6a_vm_jit_ops* ops_,
+                bool promises, bool force_exec, const char* err_stage_) {
+    err_stage = err_stage_;
+    ops = ops_;
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    if (UNLIKELY(text_len > INT32_MAX / JIT_INS_MAX_SIZE)) {
+        u6a_err_custom(err_stage, "text too long to be compiled");
+        return false;
+    }
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    code_size = U6A_ALIGN_UP(JIT_STUBS_SIZE + ((size_t)text_len + 1) * JIT_INS_MAX_SIZE, page_size);
+    code = mmap(NULL, code_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (UNLIKELY(code == MAP_FAILED)) {
+        code = NULL;
+        u6a_err_bad_alloc(err_stage, code_size);
+        return false;
+    }
+    table = malloc(text_len * sizeof(void*));
+    if (UNLIKELY(table == NULL)) {
+        u6a_err_bad_alloc(err_stage, text_len * sizeof(void*));
+        goto jit_init_failed;
+    }
+    table_len = text_len;
+    cursor = code;
+    jit_stubs();
+    for (uint32_t offset = 0; offset < text_len; ++offset) {
+        table[offset] = cursor;
+        jit_ins(text + offset, offset, promises, force_exec);
+    }
+    // Running past the end of text
+    EMIT(0xE9);                                       /* jmp stub_error */
+    emit_rel32(stub_error);
+    stats.code_size = cursor - code;
+    if (UNLIKELY(mprotect(code, code_size, PROT_READ | PROT_EXEC))) {
+        u6a_err_custom(err_stage, "failed to make native code executable");
+        goto jit_init_failed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stats.compile_nsec = (end.tv_sec - begin.tv_sec) * UINT64_C(1000000000) + end.tv_nsec - begin.tv_nsec;
+    return true;
+
+    jit_init_failed:
+    u6a_vm_jit_destroy();
+    return false;
+}
+
+struct u6a_vm_jit_ret
+u6a_vm_jit_run(uint32_t offset) {
+    return entry(table, offset);
+}
+
+const struct u6a_vm_jit_stats*
+u6a_vm_jit_stats() {
+    return &stats;
+}
+
+void
+u6a_vm_jit_destroy() {
+    if (code) {
+        munmap(code, code_size);
+    }
+    free(table);
+    code = NULL;
+    table = NULL;
+}
+
+#endif
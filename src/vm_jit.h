@@ -0,0 +1,47 @@
+/*
+ * vm_jit.h - Unlambda VM native code compiler definitions
+ * 
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef U6A_VM_JIT_H_
+#define U6A_VM_JIT_H_
+
+#include "common.h"
+#include "vm_defs.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct u6a_vm_jit_stats {
+    uint64_t compile_nsec;  /* time spent on compilation */
+    uint32_t code_size;     /* bytes of native code */
+};
+
+bool
+u6a_vm_jit_init(const struct u6a_vm_ins* text, uint32_t text_len, const struct u6a_vm_jit_ops* ops,
+                bool promises, bool force_exec, const char* err_stage);
+
+struct u6a_vm_jit_ret
+u6a_vm_jit_run(uint32_t offset);
+
+const struct u6a_vm_jit_stats*
+u6a_vm_jit_stats();
+
+void
+u6a_vm_jit_destroy();
+
+#endif
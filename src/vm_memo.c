@@ -0,0 +1,150 @@
+/*
+ * vm_memo.c - Unlambda VM application result cache
+ * 
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "vm_memo.h"
+#include "vm_pool.h"
+#include "logging.h"
+
+#include <stdlib.h>
+
+struct vm_memo_entry {
+    struct u6a_vm_var_fn func;
+    struct u6a_vm_var_fn arg;
+    struct u6a_vm_var_fn result;          /* placeholder if entry is empty */
+};
+
+// Cache is two-way set associative. A new result replaces the entry of its set which was less recently used.
+static struct vm_memo_entry* entries;
+static        uint8_t*       recent;      /* way of each set which was used last */
+static        uint32_t       set_mask;
+
+static struct u6a_vm_memo_stats stats;
+
+static const char* err_stage;
+
+// Refs of primitive functions may be left over from earlier values, and are not compared
+static inline struct u6a_vm_var_fn
+vm_memo_normalize(struct u6a_vm_var_fn var) {
+    if (!(var.token.fn & (U6A_VM_FN_REF | U6A_VM_FN_INTERNAL))) {
+        var.ref = 0;
+    }
+    var.reserved_ = 0;
+    return var;
+}
+
+static inline bool
+vm_memo_var_eq(struct u6a_vm_var_fn var1, struct u6a_vm_var_fn var2) {
+    return var1.token.fn == var2.token.fn && var1.token.ch == var2.token.ch && var1.ref == var2.ref;
+}
+
+static inline uint32_t
+vm_memo_set(struct u6a_vm_var_fn func, struct u6a_vm_var_fn arg) {
+    uint64_t hash = ((uint64_t)func.token.fn << 32 | func.ref) * UINT64_C(0x9E3779B97F4A7C15);
+    hash = (hash ^ (hash >> 29) ^ ((uint64_t)arg.token.fn << 32 | arg.ref)) * UINT64_C(0xBF58476D1CE4E5B9);
+    return (hash >> 32) & set_mask;
+}
+
+static inline void
+vm_memo_var_free(struct u6a_vm_var_fn var) {
+    if (var.token.fn & U6A_VM_FN_REF) {
+        u6a_vm_pool_free(var.ref);
+    }
+}
+
+bool
+u6a_vm_memo_init(uint32_t size, const char* err_stage_) {
+    err_stage = err_stage_;
+    const uint32_t set_cnt = size / 2;
+    entries = calloc(size, sizeof(struct vm_memo_entry));
+    if (UNLIKELY(entries == NULL)) {
+        u6a_err_bad_alloc(err_stage, size * sizeof(struct vm_memo_entry));
+        return false;
+    }
+    recent = calloc(set_cnt, sizeof(uint8_t));
+    if (UNLIKELY(recent == NULL)) {
+        u6a_err_bad_alloc(err_stage, set_cnt * sizeof(uint8_t));
+        u6a_vm_memo_destroy();
+        return false;
+    }
+    set_mask = set_cnt - 1;
+    stats = (struct u6a_vm_memo_stats) { 0 };
+    return true;
+}
+
+bool
+u6a_vm_memo_lookup(struct u6a_vm_var_fn func, struct u6a_vm_var_fn arg, struct u6a_vm_var_fn* result) {
+    func = vm_memo_normalize(func);
+    arg = vm_memo_normalize(arg);
+    const uint32_t set = vm_memo_set(func, arg);
+    for (uint32_t way = 0; way < 2; ++way) {
+        struct vm_memo_entry* entry = entries + set * 2 + way;
+        if (entry->result.token.fn && vm_memo_var_eq(entry->func, func) && vm_memo_var_eq(entry->arg, arg)) {
+            recent[set] = way;
+            if (entry->result.token.fn & U6A_VM_FN_REF) {
+                u6a_vm_pool_addref(entry->result.ref);
+            }
+            *result = entry->result;
+            ++stats.hits;
+            return true;
+        }
+    }
+    ++stats.misses;
+    return false;
+}
+
+void
+u6a_vm_memo_record(struct u6a_vm_var_fn func, struct u6a_vm_var_fn arg, struct u6a_vm_var_fn result) {
+    func = vm_memo_normalize(func);
+    arg = vm_memo_normalize(arg);
+    const uint32_t set = vm_memo_set(func, arg);
+    for (uint32_t way = 0; way < 2; ++way) {
+        struct vm_memo_entry* entry = entries + set * 2 + way;
+        if (entry->result.token.fn && vm_memo_var_eq(entry->func, func) && vm_memo_var_eq(entry->arg, arg)) {
+            // Already recorded by a nested application of the same values
+            vm_memo_var_free(func);
+            vm_memo_var_free(arg);
+            vm_memo_var_free(result);
+            return;
+        }
+    }
+    const uint32_t way = !recent[set];
+    struct vm_memo_entry* entry = entries + set * 2 + way;
+    if (entry->result.token.fn) {
+        vm_memo_var_free(entry->func);
+        vm_memo_var_free(entry->arg);
+        vm_memo_var_free(entry->result);
+        ++stats.evictions;
+    }
+    *entry = (struct vm_memo_entry) { .func = func, .arg = arg, .result = result };
+    recent[set] = way;
+    ++stats.records;
+}
+
+const struct u6a_vm_memo_stats*
+u6a_vm_memo_stats() {
+    return &stats;
+}
+
+void
+u6a_vm_memo_destroy() {
+    free(entries);
+    free(recent);
+    entries = NULL;
+    recent = NULL;
+}
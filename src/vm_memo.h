@@ -0,0 +1,53 @@
+/*
+ * vm_memo.h - Unlambda VM application result cache definitions
+ * 
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef U6A_VM_MEMO_H_
+#define U6A_VM_MEMO_H_
+
+#include "common.h"
+#include "vm_defs.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct u6a_vm_memo_stats {
+    uint64_t hits;          /* applications short-circuited to a recorded result */
+    uint64_t misses;        /* applications reduced, as no result was recorded */
+    uint64_t records;       /* results recorded */
+    uint64_t evictions;     /* recorded results dropped to make room for new ones */
+};
+
+bool
+u6a_vm_memo_init(uint32_t size, const char* err_stage);
+
+// On hit, result is given a reference of its own
+bool
+u6a_vm_memo_lookup(struct u6a_vm_var_fn func, struct u6a_vm_var_fn arg, struct u6a_vm_var_fn* result);
+
+// References held by all values are moved into the cache
+void
+u6a_vm_memo_record(struct u6a_vm_var_fn func, struct u6a_vm_var_fn arg, struct u6a_vm_var_fn result);
+
+const struct u6a_vm_memo_stats*
+u6a_vm_memo_stats();
+
+void
+u6a_vm_memo_destroy();
+
+#endif
@@ -0,0 +1,271 @@
+/*
+ * vm_output.c - Unlambda VM output buffer
+ * 
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "vm_output.h"
+#include "logging.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#ifdef HAVE_OUTPUT_THREAD
+#include <pthread.h>
+#endif
+
+// The buffer is a ring, positions are free-running counters masked on access.
+// Bytes in [tail, submitted) are handed over to the writer, [submitted, head) are still being filled.
+static char*    buffer;
+static uint32_t buffer_mask;
+static uint32_t buffer_size;
+static uint32_t head;
+static uint32_t submitted;
+static uint32_t tail;
+static uint32_t flush_threshold;
+static bool     line_buffered;
+static int      output_fd;
+
+#ifdef HAVE_OUTPUT_THREAD
+static bool            use_thread;
+static bool            thread_stopping;
+static uint32_t        tail_cached;
+static pthread_t       writer_thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cond_data = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  cond_space = PTHREAD_COND_INITIALIZER;
+#endif
+
+static const char* err_stage;
+static const char* output_name = "STDOUT";
+
+static inline void
+write_range(uint32_t from, uint32_t to) {
+    while (from != to) {
+        const uint32_t begin = from & buffer_mask;
+        const uint32_t len = to - from;
+        struct iovec iov[2];
+        int iov_cnt = 1;
+        if (begin + len > buffer_size) {
+            iov[0] = (struct iovec) { .iov_base = buffer + begin, .iov_len = buffer_size - begin };
+            iov[1] = (struct iovec) { .iov_base = buffer, .iov_len = len - (buffer_size - begin) };
+            iov_cnt = 2;
+        } else {
+            iov[0] = (struct iovec) { .iov_base = buffer + begin, .iov_len = len };
+        }
+        const ssize_t written = writev(output_fd, iov, iov_cnt);
+        if (UNLIKELY(written < 0)) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Data which cannot be written is dropped, as stdio does
+            u6a_err_write_failed(err_stage, len, output_name);
+            return;
+        }
+        from += written;
+    }
+}
+
+#ifdef HAVE_OUTPUT_THREAD
+
+static void*
+writer_thread_main(void* unused) {
+    (void) unused;
+    pthread_mutex_lock(&lock);
+    while (true) {
+        while (tail == submitted && !thread_stopping) {
+            pthread_cond_wait(&cond_data, &lock);
+        }
+        if (tail == submitted) {
+            break;
+        }
+        const uint32_t from = tail, to = submitted;
+        pthread_mutex_unlock(&lock);
+        write_range(from, to);
+        pthread_mutex_lock(&lock);
+        tail = to;
+        pthread_cond_broadcast(&cond_space);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+#endif
+
+static inline void
+submit() {
+#ifdef HAVE_OUTPUT_THREAD
+    if (use_thread) {
+        pthread_mutex_lock(&lock);
+        submitted = head;
+        tail_cached = tail;
+        pthread_cond_signal(&cond_data);
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+#endif
+    write_range(tail, head);
+    tail = submitted = head;
+}
+
+static void
+make_room() {
+#ifdef HAVE_OUTPUT_THREAD
+    if (use_thread) {
+        pthread_mutex_lock(&lock);
+        submitted = head;
+        pthread_cond_signal(&cond_data);
+        while (head - tail == buffer_size) {
+            pthread_cond_wait(&cond_space, &lock);
+        }
+        tail_cached = tail;
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+#endif
+    submit();
+}
+
+static inline uint32_t
+available() {
+#ifdef HAVE_OUTPUT_THREAD
+    if (use_thread) {
+        // Stale value of the tail only makes the free space look smaller
+        return buffer_size - (head - tail_cached);
+    }
+#endif
+    return buffer_size - (head - tail);
+}
+
+bool
+u6a_vm_output_init(int fd, uint32_t buffer_size_, bool use_thread_, const char* err_stage_) {
+    err_stage = err_stage_;
+    output_fd = fd;
+    buffer_size = 1;
+    while (buffer_size < buffer_size_) {
+        buffer_size <<= 1;
+    }
+    buffer_mask = buffer_size - 1;
+    buffer = malloc(buffer_size);
+    if (UNLIKELY(buffer == NULL)) {
+        u6a_err_bad_alloc(err_stage, buffer_size);
+        return false;
+    }
+    head = submitted = tail = 0;
+    line_buffered = isatty(fd);
+    flush_threshold = buffer_size;
+#ifdef HAVE_OUTPUT_THREAD
+    use_thread = use_thread_;
+    if (use_thread) {
+        // Hand over half a buffer at a time, so that the VM can fill the other half meanwhile
+        flush_threshold = buffer_size > 1 ? buffer_size / 2 : 1;
+        tail_cached = 0;
+        thread_stopping = false;
+        if (UNLIKELY(pthread_create(&writer_thread, NULL, writer_thread_main, NULL))) {
+            u6a_err_custom(err_stage, "failed to create output thread");
+            free(buffer);
+            buffer = NULL;
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+U6A_HOT void
+u6a_vm_output_putc(char ch) {
+    if (UNLIKELY(available() == 0)) {
+        make_room();
+    }
+    buffer[head++ & buffer_mask] = ch;
+    if (UNLIKELY(head - submitted >= flush_threshold || (ch == '\n' && line_buffered))) {
+        submit();
+    }
+}
+
+U6A_HOT void
+u6a_vm_output_write(const char* str, uint32_t len) {
+    const bool has_newline = line_buffered && memchr(str, '\n', len);
+    while (len) {
+        uint32_t room = available();
+        if (UNLIKELY(room == 0)) {
+            make_room();
+            room = available();
+        }
+        uint32_t chunk = len < room ? len : room;
+        const uint32_t begin = head & buffer_mask;
+        if (begin + chunk > buffer_size) {
+            chunk = buffer_size - begin;
+        }
+        memcpy(buffer + begin, str, chunk);
+        head += chunk;
+        str += chunk;
+        len -= chunk;
+        if (head - submitted >= flush_threshold) {
+            submit();
+        }
+    }
+    if (UNLIKELY(has_newline && head != submitted)) {
+        submit();
+    }
+}
+
+void
+u6a_vm_output_flush() {
+    if (buffer == NULL) {
+        return;
+    }
+    if (head != submitted) {
+        submit();
+    }
+#ifdef HAVE_OUTPUT_THREAD
+    if (use_thread) {
+        pthread_mutex_lock(&lock);
+        while (tail != submitted) {
+            pthread_cond_wait(&cond_space, &lock);
+        }
+        tail_cached = tail;
+        pthread_mutex_unlock(&lock);
+    }
+#endif
+}
+
+bool
+u6a_vm_output_interactive() {
+    return line_buffered;
+}
+
+void
+u6a_vm_output_destroy() {
+    if (buffer == NULL) {
+        return;
+    }
+    u6a_vm_output_flush();
+#ifdef HAVE_OUTPUT_THREAD
+    if (use_thread) {
+        pthread_mutex_lock(&lock);
+        thread_stopping = true;
+        pthread_cond_signal(&cond_data);
+        pthread_mutex_unlock(&lock);
+        pthread_join(writer_thread, NULL);
+    }
+#endif
+    free(buffer);
+    buffer = NULL;
+}
@@ -0,0 +1,46 @@
+/*
+ * vm_output.h - Unlambda VM output buffer definitions
+ * 
+ * Copyright (C) 2020  CismonX <admin@cismon.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef U6A_VM_OUTPUT_H_
+#define U6A_VM_OUTPUT_H_
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+bool
+u6a_vm_output_init(int fd, uint32_t buffer_size, bool use_thread, const char* err_stage);
+
+void
+u6a_vm_output_putc(char ch);
+
+void
+u6a_vm_output_write(const char* str, uint32_t len);
+
+void
+u6a_vm_output_flush();
+
+bool
+u6a_vm_output_interactive();
+
+void
+u6a_vm_output_destroy();
+
+#endif
@@ -21,186 +21,1128 @@
 #include "vm_stack.h"
 #include "logging.h"
 
+#include <errno.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
+// Values of a pool element are stored split into tokens and refs, so that an element fits in 16 bytes.
+// A continuation holds a stack pointer along with the offset of its instruction instead.
 struct vm_pool_elem {
-    struct u6a_vm_var_tuple values;
-    uint32_t                refcnt;
-    uint32_t                flags;
+    uint32_t refcnt;                    /* POOL_ELEM_* flags folded into the highest bits */
+    union {
+        struct u6a_token tokens[2];
+        uint32_t         offset;
+        uint32_t         next_free;     /* index of next free element in region, UINT32_MAX if none */
+    } head;                             /* values of a pending element are kept until reused */
+    union {
+        uint32_t         refs[2];
+        void*            ptr;
+    } body;
 };
 
-#define POOL_ELEM_HOLDS_PTR ( 1 << 0 )
+#define POOL_ELEM_HOLDS_PTR    ( 1u << 31 )
+#define POOL_ELEM_IN_ZCT       ( 1u << 30 )
+#define POOL_ELEM_PURE         ( 1u << 29 )     /* values are built from pure functions only */
+#define POOL_ELEM_REFCNT(elem) ( (elem)->refcnt & ~(POOL_ELEM_HOLDS_PTR | POOL_ELEM_IN_ZCT | POOL_ELEM_PURE) )
+// Count of an immortal element, which sticks once the counter saturates. References to it are no longer counted,
+// and it is never freed.
+// Builds for testing may lower it, so that elements become immortal in small programs.
+#ifdef U6A_VM_POOL_IMMORTAL
+#if U6A_VM_POOL_IMMORTAL < 2 || U6A_VM_POOL_IMMORTAL >= POOL_ELEM_PURE
+#error "U6A_VM_POOL_IMMORTAL must be a count above 1 which fits in refcnt"
+#endif
+#define POOL_ELEM_IMMORTAL     ( U6A_VM_POOL_IMMORTAL )
+#else
+#define POOL_ELEM_IMMORTAL     ( POOL_ELEM_PURE - 1 )
+#endif
 
-struct vm_pool {
-    uint32_t pos;
-    struct vm_pool_elem elems[];
-};
+// Pool is managed in regions, each having its own free list, so that a region with no live elements
+// can be returned to the OS by simply forgetting about its free list.
+#define POOL_REGION_SHIFT   16
+#define POOL_REGION_LEN   ( 1 << POOL_REGION_SHIFT )
 
-struct vm_pool_elem_ptrs {
-    uint32_t pos;
-    struct vm_pool_elem* elems[];
+struct vm_pool_region {
+    uint32_t live;                      /* elements in use */
+    uint32_t used;                      /* elements ever allocated from the beginning of region */
+    uint32_t free_head;                 /* index of first free element, UINT32_MAX if none */
+    bool     queued;                    /* whether the region is in the list of regions with room */
 };
 
-static struct vm_pool*           active_pool;
-static struct vm_pool_elem_ptrs* holes;
-static        uint32_t           pool_len;
-static struct vm_pool_elem**     fstack;
-static        uint32_t           fstack_top;
+// Address space for the maximum number of elements is reserved at once, so that elements never move.
+// Pages are committed as the pool grows.
+static struct vm_pool_elem*   pool;
+static        uint32_t        pool_len;
+static        uint32_t        pool_max_len;
+static struct vm_pool_region* regions;
+static        uint32_t        region_cnt;
+static        uint32_t        region_active;
+static        uint32_t*       region_queue;
+static        uint32_t        region_queue_top;
+static        uint32_t        release_countdown;
+static        size_t          page_size;
+// Dead elements whose values are yet to be released, linked through their refcnt
+static        uint32_t        pending_head;
+
+// With hash-consing, elements holding the same values are shared instead of allocated anew. Live elements
+// other than continuations are looked up in an open addressing table with linear probing.
+static        bool            hash_cons;
+static        bool            alloc_indirect;   /* hash-consing, purity tracking, or collection other than refcounting */
+static        uint32_t*       hc_table;         /* element indices, UINT32_MAX if empty */
+static        uint32_t        hc_mask;
+static        uint32_t        hc_len;
+
+// With purity tracking, elements allocated over pure values are marked as such, so that whether a value is pure
+// is known without walking through it.
+static        bool            track_purity;
+
+// With tracing collection, elements are allocated by bumping an index, and carry no reference count
+// (the field only keeps POOL_ELEM_HOLDS_PTR). When the pool fills up, elements reachable from the stacks
+// and from the values being allocated are marked, then slid towards the beginning of the pool, with refs
+// to them rewritten, so that live elements always take a contiguous range.
+static        enum u6a_vm_gc  gc_mode;
+static        uint32_t        gc_top;           /* elements below are allocated */
+static        uint64_t*       gc_bitmap;        /* mark bits */
+static        uint32_t*       gc_fwd_base;      /* new index of the first live element in every 64 */
+static        uint32_t*       gc_mark_stack;
+static        uint32_t        gc_mark_stack_top;
+static        uint32_t        gc_cap;           /* elements covered by the buffers above */
+static        uint32_t        gc_pass;
+
+// With deferred reference counting, only refs held by elements are counted, while those on the stacks
+// (and in the runtime's registers) are not. Elements with a zero count are put into a table, and once it
+// fills up, those not referred to by any stack are freed. Stacks of continuations held by elements count
+// as well, for which continuations are kept in a list.
+static        uint32_t*       zct;
+static        uint32_t        zct_len;
+static        uint32_t        zct_cap;
+static        uint32_t        zct_limit;        /* table is reconciled when it grows this long */
+static        uint32_t*       conts;
+static        uint32_t        conts_len;
+static        uint32_t        conts_cap;
 
-const char* err_stage;
+static struct u6a_vm_pool_stats stats;
 
+static const char* err_stage;
+
+// Where address space is limited (e.g. by RLIMIT_AS), the reservation is halved until it fits,
+// but never below the initial length of the pool.
 static inline struct vm_pool_elem*
-vm_pool_elem_alloc() {
-    struct vm_pool_elem* new_elem;
-    if (holes->pos == UINT32_MAX) {
-        if (UNLIKELY(++active_pool->pos == pool_len)) {
-            u6a_err_vm_pool_oom(err_stage);
+reserve_pages(uint32_t* max_len, uint32_t min_len) {
+    for (;;) {
+        const size_t size = (size_t)*max_len * sizeof(struct vm_pool_elem);
+        void* addr = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (LIKELY(addr != MAP_FAILED)) {
+            return addr;
+        }
+        if (errno != ENOMEM || *max_len / 2 < min_len) {
+            u6a_err_bad_alloc(err_stage, size);
             return NULL;
         }
-        new_elem = active_pool->elems + active_pool->pos;
+        *max_len /= 2;
+    }
+}
+
+static inline bool
+commit_pages(void* base, size_t from, size_t to) {
+    from = U6A_ALIGN_UP(from, page_size);
+    to = U6A_ALIGN_UP(to, page_size);
+    if (from < to && UNLIKELY(mprotect((char*)base + from, to - from, PROT_READ | PROT_WRITE))) {
+        u6a_err_bad_alloc(err_stage, to - from);
+        return false;
+    }
+    return true;
+}
+
+static bool
+vm_pool_grow() {
+    if (UNLIKELY(pool_len == pool_max_len)) {
+        u6a_err_vm_pool_oom(err_stage);
+        return false;
+    }
+    const uint32_t new_len = pool_len > pool_max_len - pool_len ? pool_max_len : pool_len * 2;
+    if (UNLIKELY(!commit_pages(pool, (size_t)pool_len * sizeof(struct vm_pool_elem),
+            (size_t)new_len * sizeof(struct vm_pool_elem)))) {
+        return false;
+    }
+    pool_len = new_len;
+    return true;
+}
+
+static inline void
+vm_pool_region_enqueue(uint32_t region) {
+    if (!regions[region].queued) {
+        regions[region].queued = true;
+        region_queue[++region_queue_top] = region;
+    }
+}
+
+// Empty regions are looked for once every POOL_REGION_LEN frees, so that a region which keeps getting emptied
+// and refilled does not cost a system call each time.
+static void
+vm_pool_release_regions() {
+    release_countdown = POOL_REGION_LEN;
+    for (uint32_t region = 0; region < region_cnt; ++region) {
+        struct vm_pool_region* rgn = regions + region;
+        if (rgn->live || rgn->used == 0) {
+            continue;
+        }
+        const size_t begin = U6A_ALIGN_UP((size_t)region * POOL_REGION_LEN * sizeof(struct vm_pool_elem), page_size);
+        const size_t end = ((size_t)region * POOL_REGION_LEN + rgn->used) * sizeof(struct vm_pool_elem)
+            / page_size * page_size;
+        if (begin < end) {
+            madvise((char*)pool + begin, end - begin, MADV_DONTNEED);
+        }
+        rgn->used = 0;
+        rgn->free_head = UINT32_MAX;
+        vm_pool_region_enqueue(region);
+        ++stats.released;
+    }
+}
+
+static inline bool
+vm_pool_region_full(uint32_t region) {
+    const struct vm_pool_region* rgn = regions + region;
+    return rgn->free_head == UINT32_MAX
+        && (rgn->used == POOL_REGION_LEN || (uint64_t)region * POOL_REGION_LEN + rgn->used == pool_max_len);
+}
+
+// Switch to another region with room for allocation, preferring partially used ones over fresh ones
+static bool
+vm_pool_region_switch() {
+    while (region_queue_top != UINT32_MAX) {
+        const uint32_t region = region_queue[region_queue_top--];
+        regions[region].queued = false;
+        if (!vm_pool_region_full(region)) {
+            region_active = region;
+            return true;
+        }
+    }
+    if (UNLIKELY((uint64_t)region_cnt * POOL_REGION_LEN >= pool_max_len)) {
+        u6a_err_vm_pool_oom(err_stage);
+        return false;
+    }
+    regions[region_cnt] = (struct vm_pool_region) { .free_head = UINT32_MAX };
+    region_active = region_cnt++;
+    return true;
+}
+
+static inline void
+vm_pool_elem_release(struct vm_pool_elem* elem) {
+    const uint32_t idx = elem - pool;
+    const uint32_t region = idx >> POOL_REGION_SHIFT;
+    struct vm_pool_region* rgn = regions + region;
+    --rgn->live;
+    elem->head.next_free = rgn->free_head;
+    rgn->free_head = idx;
+    if (region != region_active) {
+        vm_pool_region_enqueue(region);
+    }
+    if (UNLIKELY(--release_countdown == 0)) {
+        vm_pool_release_regions();
+    }
+}
+
+static inline void
+vm_pool_elem_addref(struct vm_pool_elem* elem) {
+    // Checking for immortality keeps the counter from overflowing into the flags as well
+    if (LIKELY(POOL_ELEM_REFCNT(elem) != POOL_ELEM_IMMORTAL)) {
+        ++elem->refcnt;
+    }
+}
+
+// Drops a reference which is known not to be the last one
+static inline void
+vm_pool_elem_decref(struct vm_pool_elem* elem) {
+    if (LIKELY(POOL_ELEM_REFCNT(elem) != POOL_ELEM_IMMORTAL)) {
+        --elem->refcnt;
+    }
+}
+
+static inline union u6a_vm_var
+vm_pool_elem_value(struct vm_pool_elem* elem, uint32_t idx) {
+    return U6A_VM_VAR_FN(((struct u6a_vm_var_fn) { .token = elem->head.tokens[idx], .ref = elem->body.refs[idx] }));
+}
+
+static inline uint32_t
+vm_pool_hc_hash(struct u6a_vm_var_fn v1, struct u6a_vm_var_fn v2) {
+    const uint32_t tokens = (uint32_t)v1.token.fn | (uint32_t)v1.token.ch << 8
+        | (uint32_t)v2.token.fn << 16 | (uint32_t)v2.token.ch << 24;
+    uint64_t hash = ((uint64_t)tokens << 32 | v1.ref) * UINT64_C(0x9E3779B97F4A7C15);
+    hash = (hash ^ (hash >> 29) ^ v2.ref) * UINT64_C(0xBF58476D1CE4E5B9);
+    return hash >> 32;
+}
+
+static inline uint32_t
+vm_pool_hc_elem_hash(const struct vm_pool_elem* elem) {
+    return vm_pool_hc_hash(
+        (struct u6a_vm_var_fn) { .token = elem->head.tokens[0], .ref = elem->body.refs[0] },
+        (struct u6a_vm_var_fn) { .token = elem->head.tokens[1], .ref = elem->body.refs[1] }
+    );
+}
+
+// Finds the slot of the element holding given values, or the empty slot where it would be inserted
+static inline uint32_t
+vm_pool_hc_probe(struct u6a_vm_var_fn v1, struct u6a_vm_var_fn v2) {
+    for (uint32_t slot = vm_pool_hc_hash(v1, v2) & hc_mask; ; slot = (slot + 1) & hc_mask) {
+        const uint32_t idx = hc_table[slot];
+        if (idx == UINT32_MAX) {
+            return slot;
+        }
+        const struct vm_pool_elem* elem = pool + idx;
+        if (elem->body.refs[0] == v1.ref && elem->body.refs[1] == v2.ref
+            && elem->head.tokens[0].fn == v1.token.fn && elem->head.tokens[0].ch == v1.token.ch
+            && elem->head.tokens[1].fn == v2.token.fn && elem->head.tokens[1].ch == v2.token.ch) {
+            return slot;
+        }
+    }
+}
+
+static inline uint32_t
+vm_pool_hc_elem_probe(const struct vm_pool_elem* elem) {
+    return vm_pool_hc_probe(
+        (struct u6a_vm_var_fn) { .token = elem->head.tokens[0], .ref = elem->body.refs[0] },
+        (struct u6a_vm_var_fn) { .token = elem->head.tokens[1], .ref = elem->body.refs[1] }
+    );
+}
+
+static bool
+vm_pool_hc_insert(uint32_t idx) {
+    if (UNLIKELY(hc_len >= (hc_mask >> 1))) {
+        // Table is kept at most half full
+        const uint32_t new_size = (hc_mask + 1) * 2;
+        uint32_t* new_table = malloc((size_t)new_size * sizeof(uint32_t));
+        if (UNLIKELY(new_table == NULL || new_size == 0)) {
+            free(new_table);
+            u6a_err_bad_alloc(err_stage, (size_t)new_size * sizeof(uint32_t));
+            return false;
+        }
+        memset(new_table, 0xFF, (size_t)new_size * sizeof(uint32_t));
+        uint32_t* old_table = hc_table;
+        const uint32_t old_mask = hc_mask;
+        hc_table = new_table;
+        hc_mask = new_size - 1;
+        for (uint32_t slot = 0; slot <= old_mask; ++slot) {
+            if (old_table[slot] != UINT32_MAX) {
+                hc_table[vm_pool_hc_elem_probe(pool + old_table[slot])] = old_table[slot];
+            }
+        }
+        free(old_table);
+    }
+    hc_table[vm_pool_hc_elem_probe(pool + idx)] = idx;
+    ++hc_len;
+    return true;
+}
+
+// Entries following the removed one are moved back, so that no probe sequence is broken
+static void
+vm_pool_hc_remove(struct vm_pool_elem* elem) {
+    uint32_t slot = vm_pool_hc_elem_probe(elem);
+    if (hc_table[slot] != (uint32_t)(elem - pool)) {
+        return;
+    }
+    for (uint32_t next = (slot + 1) & hc_mask; hc_table[next] != UINT32_MAX; next = (next + 1) & hc_mask) {
+        const uint32_t home = vm_pool_hc_elem_hash(pool + hc_table[next]) & hc_mask;
+        if (((next - home) & hc_mask) >= ((next - slot) & hc_mask)) {
+            hc_table[slot] = hc_table[next];
+            slot = next;
+        }
+    }
+    hc_table[slot] = UINT32_MAX;
+    --hc_len;
+}
+
+// Freeing an element takes constant time. Instead of being released recursively, values of a dead element
+// are released when the element is reused by a later allocation, so that dropping a large structure
+// does not pause execution.
+static inline void
+vm_pool_elem_unref(struct vm_pool_elem* elem) {
+    const uint32_t refcnt = POOL_ELEM_REFCNT(elem);
+    // Shared elements are told apart from both the dying and the immortal ones with a single comparison
+    if (LIKELY(refcnt - 2 < POOL_ELEM_IMMORTAL - 2)) {
+        --elem->refcnt;
+    } else if (refcnt == POOL_ELEM_IMMORTAL) {
+        return;
+    } else if (elem->refcnt & POOL_ELEM_HOLDS_PTR) {
+        // Continuation destroyed before used
+        u6a_vm_stack_discard(elem->body.ptr);
+        elem->refcnt = 0;
+        vm_pool_elem_release(elem);
     } else {
-        new_elem = holes->elems[holes->pos--];
+        if (UNLIKELY(hash_cons)) {
+            vm_pool_hc_remove(elem);
+        }
+        elem->refcnt = pending_head;
+        pending_head = elem - pool;
     }
-    new_elem->refcnt = 1;
-    return new_elem;
 }
 
-static inline struct vm_pool_elem*
-vm_pool_elem_dup(struct vm_pool_elem* elem) {
-    struct vm_pool_elem* new_elem = vm_pool_elem_alloc();
-    if (UNLIKELY(new_elem == NULL)) {
+static inline void
+vm_pool_value_unref(struct vm_pool_elem* elem, uint32_t idx) {
+    if (elem->head.tokens[idx].fn & U6A_VM_FN_REF) {
+        vm_pool_elem_unref(pool + elem->body.refs[idx]);
+    }
+}
+
+static struct vm_pool_elem*
+vm_pool_elem_alloc_slow() {
+    struct vm_pool_region* rgn = regions + region_active;
+    if (vm_pool_region_full(region_active)) {
+        if (UNLIKELY(!vm_pool_region_switch())) {
+            return NULL;
+        }
+        rgn = regions + region_active;
+        if (rgn->free_head != UINT32_MAX) {
+            struct vm_pool_elem* new_elem = pool + rgn->free_head;
+            rgn->free_head = new_elem->head.next_free;
+            return new_elem;
+        }
+    }
+    const uint32_t idx = region_active * POOL_REGION_LEN + rgn->used;
+    if (idx >= pool_len && UNLIKELY(!vm_pool_grow())) {
         return NULL;
     }
-    *new_elem = *elem;
+    ++rgn->used;
+    return pool + idx;
+}
+
+static inline struct vm_pool_elem*
+vm_pool_elem_alloc() {
+    struct vm_pool_elem* new_elem;
+    if (pending_head != UINT32_MAX) {
+        // Takes over a dead element, which is still accounted as live in its region
+        new_elem = pool + pending_head;
+        pending_head = new_elem->refcnt;
+        vm_pool_value_unref(new_elem, 0);
+        vm_pool_value_unref(new_elem, 1);
+        return new_elem;
+    }
+    struct vm_pool_region* rgn = regions + region_active;
+    if (LIKELY(rgn->free_head != UINT32_MAX)) {
+        new_elem = pool + rgn->free_head;
+        rgn->free_head = new_elem->head.next_free;
+    } else {
+        const uint32_t idx = region_active * POOL_REGION_LEN + rgn->used;
+        if (LIKELY(rgn->used < POOL_REGION_LEN && idx < pool_len)) {
+            ++rgn->used;
+            new_elem = pool + idx;
+        } else {
+            new_elem = vm_pool_elem_alloc_slow();
+            if (UNLIKELY(new_elem == NULL)) {
+                return NULL;
+            }
+            rgn = regions + region_active;
+        }
+    }
+    ++rgn->live;
     return new_elem;
 }
 
 static inline void
-free_stack_push(struct u6a_vm_var_fn fn) {
-    if (fn.token.fn & U6A_VM_FN_REF) {
-        fstack[++fstack_top] = active_pool->elems + fn.ref;
+vm_pool_value_addref(struct vm_pool_elem* elem, uint32_t idx) {
+    if (elem->head.tokens[idx].fn & U6A_VM_FN_REF) {
+        vm_pool_elem_addref(pool + elem->body.refs[idx]);
     }
 }
 
-static inline struct vm_pool_elem*
-free_stack_pop() {
-    if (fstack_top == UINT32_MAX) {
-        return NULL;
+static inline uint32_t
+popcount64(uint64_t bits) {
+#ifdef __GNUC__
+    return __builtin_popcountll(bits);
+#else
+    uint32_t cnt = 0;
+    for (; bits; bits &= bits - 1) {
+        ++cnt;
     }
-    return fstack[fstack_top--];
+    return cnt;
+#endif
 }
 
-bool
-u6a_vm_pool_init(uint32_t pool_len_, uint32_t ins_len, const char* err_stage_) {
-    const uint32_t pool_size = sizeof(struct vm_pool) + pool_len_ * sizeof(struct vm_pool_elem);
-    active_pool = malloc(pool_size);
-    if (UNLIKELY(active_pool == NULL)) {
-        u6a_err_bad_alloc(err_stage_, pool_size);
+static inline bool
+gc_marked(uint32_t idx) {
+    return gc_bitmap[idx >> 6] >> (idx & 63) & 1;
+}
+
+// Live elements keep their order, thus the new index is the number of live elements before
+static inline uint32_t
+gc_forward(uint32_t idx) {
+    return gc_fwd_base[idx >> 6] + popcount64(gc_bitmap[idx >> 6] & ((UINT64_C(1) << (idx & 63)) - 1));
+}
+
+static inline void
+gc_mark(uint32_t idx) {
+    const uint64_t bit = UINT64_C(1) << (idx & 63);
+    if (!(gc_bitmap[idx >> 6] & bit)) {
+        gc_bitmap[idx >> 6] |= bit;
+        gc_mark_stack[++gc_mark_stack_top] = idx;
+    }
+}
+
+static void
+gc_mark_var(struct u6a_vm_var_fn* var) {
+    if (var->token.fn & U6A_VM_FN_REF) {
+        gc_mark(var->ref);
+    }
+}
+
+static void
+gc_update_var(struct u6a_vm_var_fn* var) {
+    if (var->token.fn & U6A_VM_FN_REF) {
+        var->ref = gc_forward(var->ref);
+    }
+}
+
+static bool
+vm_pool_gc_reserve() {
+    if (gc_cap >= pool_len) {
+        return true;
+    }
+    const size_t block_cnt = ((size_t)pool_len + 63) >> 6;
+    uint64_t* bitmap = realloc(gc_bitmap, block_cnt * sizeof(uint64_t));
+    if (UNLIKELY(bitmap == NULL)) {
+        u6a_err_bad_alloc(err_stage, block_cnt * sizeof(uint64_t));
+        return false;
+    }
+    gc_bitmap = bitmap;
+    uint32_t* fwd_base = realloc(gc_fwd_base, block_cnt * sizeof(uint32_t));
+    if (UNLIKELY(fwd_base == NULL)) {
+        u6a_err_bad_alloc(err_stage, block_cnt * sizeof(uint32_t));
         return false;
     }
-    const uint32_t holes_size = sizeof(struct vm_pool_elem_ptrs) + pool_len_ * sizeof(struct vm_pool_elem*);
-    holes = malloc(holes_size);
-    if (UNLIKELY(holes == NULL)) {
-        u6a_err_bad_alloc(err_stage_, holes_size);
-        free(holes);
+    gc_fwd_base = fwd_base;
+    // Each element is pushed at most once
+    uint32_t* mark_stack = realloc(gc_mark_stack, (size_t)pool_len * sizeof(uint32_t));
+    if (UNLIKELY(mark_stack == NULL)) {
+        u6a_err_bad_alloc(err_stage, (size_t)pool_len * sizeof(uint32_t));
         return false;
     }
-    const uint32_t free_stack_size = ins_len * sizeof(struct vm_pool_elem*);
-    fstack = malloc(free_stack_size);
-    if (UNLIKELY(fstack == NULL)) {
-        u6a_err_bad_alloc(err_stage_, free_stack_size);
-        free(active_pool);
-        free(holes);
+    gc_mark_stack = mark_stack;
+    gc_cap = pool_len;
+    return true;
+}
+
+static bool
+vm_pool_collect(struct u6a_vm_var_fn* roots, uint32_t root_cnt) {
+    if (UNLIKELY(!vm_pool_gc_reserve())) {
+        return false;
+    }
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    const size_t block_cnt = ((size_t)gc_top + 63) >> 6;
+    memset(gc_bitmap, 0, block_cnt * sizeof(uint64_t));
+    // Mark elements reachable from roots. Continuations are traced through the stacks they hold.
+    gc_mark_stack_top = UINT32_MAX;
+    for (uint32_t idx = 0; idx < root_cnt; ++idx) {
+        gc_mark_var(roots + idx);
+    }
+    u6a_vm_stack_trace(NULL, ++gc_pass, gc_mark_var);
+    while (gc_mark_stack_top != UINT32_MAX) {
+        struct vm_pool_elem* elem = pool + gc_mark_stack[gc_mark_stack_top--];
+        if (elem->refcnt & POOL_ELEM_HOLDS_PTR) {
+            u6a_vm_stack_trace(elem->body.ptr, gc_pass, gc_mark_var);
+            continue;
+        }
+        if (elem->head.tokens[0].fn & U6A_VM_FN_REF) {
+            gc_mark(elem->body.refs[0]);
+        }
+        if (elem->head.tokens[1].fn & U6A_VM_FN_REF) {
+            gc_mark(elem->body.refs[1]);
+        }
+    }
+    uint32_t live = 0;
+    for (size_t block = 0; block < block_cnt; ++block) {
+        gc_fwd_base[block] = live;
+        live += popcount64(gc_bitmap[block]);
+    }
+    // Rewrite refs, then slide live elements down, dropping stacks held by dead continuations
+    u6a_vm_stack_trace(NULL, ++gc_pass, gc_update_var);
+    for (uint32_t idx = 0; idx < root_cnt; ++idx) {
+        gc_update_var(roots + idx);
+    }
+    uint32_t dest = 0;
+    for (uint32_t idx = 0; idx < gc_top; ++idx) {
+        struct vm_pool_elem* elem = pool + idx;
+        if (!gc_marked(idx)) {
+            if (elem->refcnt & POOL_ELEM_HOLDS_PTR) {
+                u6a_vm_stack_discard(elem->body.ptr);
+            }
+            continue;
+        }
+        if (elem->refcnt & POOL_ELEM_HOLDS_PTR) {
+            u6a_vm_stack_trace(elem->body.ptr, gc_pass, gc_update_var);
+        } else {
+            if (elem->head.tokens[0].fn & U6A_VM_FN_REF) {
+                elem->body.refs[0] = gc_forward(elem->body.refs[0]);
+            }
+            if (elem->head.tokens[1].fn & U6A_VM_FN_REF) {
+                elem->body.refs[1] = gc_forward(elem->body.refs[1]);
+            }
+        }
+        if (dest != idx) {
+            pool[dest] = *elem;
+            ++stats.moved;
+        }
+        ++dest;
+    }
+    gc_top = live;
+    if (hash_cons) {
+        // Elements have moved, and dead ones are gone
+        memset(hc_table, 0xFF, ((size_t)hc_mask + 1) * sizeof(uint32_t));
+        hc_len = 0;
+        for (uint32_t idx = 0; idx < live; ++idx) {
+            if (!(pool[idx].refcnt & POOL_ELEM_HOLDS_PTR)) {
+                hc_table[vm_pool_hc_elem_probe(pool + idx)] = idx;
+                ++hc_len;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ++stats.collections;
+    stats.collect_nsec += (uint64_t)(end.tv_sec - begin.tv_sec) * 1000000000 + end.tv_nsec - begin.tv_nsec;
+    stats.live = live;
+    return true;
+}
+
+// Values being allocated are roots as well, as they are yet to be stored in the new element
+static struct vm_pool_elem*
+vm_pool_gc_alloc(struct u6a_vm_var_fn* roots, uint32_t root_cnt) {
+    if (LIKELY(gc_top < pool_len)) {
+        return pool + gc_top++;
+    }
+    if (UNLIKELY(!vm_pool_collect(roots, root_cnt))) {
+        return NULL;
+    }
+    // Grow when more than half of the pool survives, so that collections do not get too frequent
+    if (gc_top > pool_len / 2 && pool_len < pool_max_len && UNLIKELY(!vm_pool_grow())) {
+        return NULL;
+    }
+    if (UNLIKELY(gc_top == pool_len)) {
+        u6a_err_vm_pool_oom(err_stage);
+        return NULL;
+    }
+    return pool + gc_top++;
+}
+
+static uint32_t
+vm_pool_gc_alloc2(struct u6a_vm_var_fn v1, struct u6a_vm_var_fn v2) {
+    struct u6a_vm_var_fn values[2] = { v1, v2 };
+    struct vm_pool_elem* elem = vm_pool_gc_alloc(values, 2);
+    if (UNLIKELY(elem == NULL)) {
+        return UINT32_MAX;
+    }
+    elem->refcnt = 0;
+    elem->head.tokens[0] = values[0].token;
+    elem->head.tokens[1] = values[1].token;
+    elem->body.refs[0] = values[0].ref;
+    elem->body.refs[1] = values[1].ref;
+    return elem - pool;
+}
+
+static bool
+vm_pool_list_push(uint32_t** list, uint32_t* len, uint32_t* cap, uint32_t idx) {
+    if (UNLIKELY(*len == *cap)) {
+        const uint32_t new_cap = *cap == 0 ? U6A_VM_ZCT_SIZE : *cap > UINT32_MAX / 2 ? UINT32_MAX : *cap * 2;
+        uint32_t* new_list = realloc(*list, (size_t)new_cap * sizeof(uint32_t));
+        if (UNLIKELY(new_list == NULL)) {
+            u6a_err_bad_alloc(err_stage, (size_t)new_cap * sizeof(uint32_t));
+            return false;
+        }
+        *list = new_list;
+        *cap = new_cap;
+    }
+    (*list)[(*len)++] = idx;
+    return true;
+}
+
+// Frees an element, along with those which are left unreferenced by it
+static bool
+vm_pool_drc_free(uint32_t idx) {
+    gc_mark_stack_top = 0;
+    gc_mark_stack[0] = idx;
+    while (gc_mark_stack_top != UINT32_MAX) {
+        struct vm_pool_elem* elem = pool + gc_mark_stack[gc_mark_stack_top--];
+        if (elem->refcnt & POOL_ELEM_HOLDS_PTR) {
+            u6a_vm_stack_discard(elem->body.ptr);
+        } else {
+            for (uint32_t val = 0; val < 2; ++val) {
+                if (!(elem->head.tokens[val].fn & U6A_VM_FN_REF)) {
+                    continue;
+                }
+                const uint32_t child_idx = elem->body.refs[val];
+                struct vm_pool_elem* child = pool + child_idx;
+                vm_pool_elem_decref(child);
+                if (POOL_ELEM_REFCNT(child) != 0 || child->refcnt & POOL_ELEM_IN_ZCT) {
+                    // Elements already in table are dealt with by the caller
+                    continue;
+                }
+                if (gc_marked(child_idx)) {
+                    // Still on stack, to be looked at next time
+                    if (UNLIKELY(!vm_pool_list_push(&zct, &zct_len, &zct_cap, child_idx))) {
+                        return false;
+                    }
+                    child->refcnt |= POOL_ELEM_IN_ZCT;
+                } else {
+                    gc_mark_stack[++gc_mark_stack_top] = child_idx;
+                }
+            }
+            if (hash_cons) {
+                vm_pool_hc_remove(elem);
+            }
+        }
+        elem->refcnt = 0;
+        vm_pool_elem_release(elem);
+        ++stats.freed;
+    }
+    return true;
+}
+
+static bool
+vm_pool_reconcile() {
+    if (UNLIKELY(!vm_pool_gc_reserve())) {
         return false;
     }
-    active_pool->pos = UINT32_MAX;
-    holes->pos = UINT32_MAX;
-    pool_len = pool_len_;
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    // Mark elements on the active stack, and on those of live continuations
+    memset(gc_bitmap, 0, (((size_t)pool_len + 63) >> 6) * sizeof(uint64_t));
+    gc_mark_stack_top = UINT32_MAX;
+    u6a_vm_stack_trace(NULL, ++gc_pass, gc_mark_var);
+    for (uint32_t idx = 0; idx < conts_len; ++idx) {
+        struct vm_pool_elem* elem = pool + conts[idx];
+        if (POOL_ELEM_REFCNT(elem) > 0) {
+            u6a_vm_stack_trace(elem->body.ptr, gc_pass, gc_mark_var);
+        }
+    }
+    while (gc_mark_stack_top != UINT32_MAX) {
+        struct vm_pool_elem* elem = pool + gc_mark_stack[gc_mark_stack_top--];
+        if (elem->refcnt & POOL_ELEM_HOLDS_PTR) {
+            u6a_vm_stack_trace(elem->body.ptr, gc_pass, gc_mark_var);
+        }
+    }
+    // Elements referred to by other elements since put into table leave it, while marked ones stay
+    const uint32_t len = zct_len;
+    uint32_t kept = 0;
+    for (uint32_t idx = 0; idx < len; ++idx) {
+        struct vm_pool_elem* elem = pool + zct[idx];
+        if (POOL_ELEM_REFCNT(elem) > 0) {
+            elem->refcnt &= ~POOL_ELEM_IN_ZCT;
+        } else if (gc_marked(zct[idx])) {
+            zct[kept++] = zct[idx];
+        } else if (UNLIKELY(!vm_pool_drc_free(zct[idx]))) {
+            return false;
+        }
+    }
+    memmove(zct + kept, zct + len, (size_t)(zct_len - len) * sizeof(uint32_t));
+    zct_len = kept + (zct_len - len);
+    // Table is allowed to grow with elements kept, so that a deep stack does not get scanned too often
+    zct_limit = zct_len > U6A_VM_ZCT_SIZE / 2 ? zct_len * 2 : U6A_VM_ZCT_SIZE;
+    kept = 0;
+    for (uint32_t idx = 0; idx < conts_len; ++idx) {
+        if (pool[conts[idx]].refcnt & POOL_ELEM_HOLDS_PTR) {
+            conts[kept++] = conts[idx];
+        }
+    }
+    conts_len = kept;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ++stats.collections;
+    stats.collect_nsec += (uint64_t)(end.tv_sec - begin.tv_sec) * 1000000000 + end.tv_nsec - begin.tv_nsec;
+    return true;
+}
+
+// New elements are not referred to by other elements, thus go into the table right away
+static struct vm_pool_elem*
+vm_pool_drc_alloc() {
+    if (UNLIKELY(zct_len >= zct_limit) && UNLIKELY(!vm_pool_reconcile())) {
+        return NULL;
+    }
+    struct vm_pool_elem* elem = vm_pool_elem_alloc();
+    if (UNLIKELY(elem == NULL)) {
+        return NULL;
+    }
+    if (UNLIKELY(!vm_pool_list_push(&zct, &zct_len, &zct_cap, elem - pool))) {
+        return NULL;
+    }
+    elem->refcnt = POOL_ELEM_IN_ZCT;
+    return elem;
+}
+
+// Values are counted before allocation, so that they survive reconciliation
+static uint32_t
+vm_pool_drc_alloc2(struct u6a_vm_var_fn v1, struct u6a_vm_var_fn v2) {
+    if (v1.token.fn & U6A_VM_FN_REF) {
+        vm_pool_elem_addref(pool + v1.ref);
+    }
+    if (v2.token.fn & U6A_VM_FN_REF) {
+        vm_pool_elem_addref(pool + v2.ref);
+    }
+    struct vm_pool_elem* elem = vm_pool_drc_alloc();
+    if (UNLIKELY(elem == NULL)) {
+        return UINT32_MAX;
+    }
+    elem->head.tokens[0] = v1.token;
+    elem->head.tokens[1] = v2.token;
+    elem->body.refs[0] = v1.ref;
+    elem->body.refs[1] = v2.ref;
+    return elem - pool;
+}
+
+// Continuations are not counted by either collector
+static uint32_t
+vm_pool_uncounted_alloc2_ptr(void* v1, uint32_t v2) {
+    struct vm_pool_elem* elem;
+    if (gc_mode == u6a_vm_gc_tracing) {
+        elem = vm_pool_gc_alloc(NULL, 0);
+        if (UNLIKELY(elem == NULL)) {
+            return UINT32_MAX;
+        }
+        elem->refcnt = POOL_ELEM_HOLDS_PTR;
+    } else {
+        elem = vm_pool_drc_alloc();
+        if (UNLIKELY(elem == NULL || !vm_pool_list_push(&conts, &conts_len, &conts_cap, elem - pool))) {
+            return UINT32_MAX;
+        }
+        elem->refcnt |= POOL_ELEM_HOLDS_PTR;
+    }
+    elem->head.offset = v2;
+    elem->body.ptr = v1;
+    return elem - pool;
+}
+
+bool
+u6a_vm_pool_init(uint32_t pool_len_, uint32_t pool_max_len_, bool huge_pages, enum u6a_vm_gc gc,
+                 bool hash_cons_, bool track_purity_, const char* err_stage_) {
     err_stage = err_stage_;
+    page_size = sysconf(_SC_PAGESIZE);
+    pool_max_len = pool_max_len_;
+    // Only matters where address space is narrower than the range of refs
+    if ((uint64_t)pool_max_len * sizeof(struct vm_pool_elem) > SIZE_MAX) {
+        pool_max_len = (uint32_t)(SIZE_MAX / sizeof(struct vm_pool_elem));
+    }
+    pool_len = pool_len_ < pool_max_len ? pool_len_ : pool_max_len;
+    pool = reserve_pages(&pool_max_len, pool_len);
+    if (UNLIKELY(pool == NULL)) {
+        return false;
+    }
+#ifdef MADV_HUGEPAGE
+    if (huge_pages) {
+        // Not an error if transparent huge pages are unavailable
+        madvise(pool, (size_t)pool_max_len * sizeof(struct vm_pool_elem), MADV_HUGEPAGE);
+    }
+#endif
+    if (UNLIKELY(!commit_pages(pool, 0, (size_t)pool_len * sizeof(struct vm_pool_elem)))) {
+        goto pool_init_failed;
+    }
+    const uint32_t max_region_cnt = ((pool_max_len - 1) >> POOL_REGION_SHIFT) + 1;
+    const size_t regions_size = max_region_cnt * (sizeof(struct vm_pool_region) + sizeof(uint32_t));
+    regions = malloc(regions_size);
+    if (UNLIKELY(regions == NULL)) {
+        u6a_err_bad_alloc(err_stage, regions_size);
+        goto pool_init_failed;
+    }
+    region_queue = (uint32_t*)(regions + max_region_cnt);
+    regions[0] = (struct vm_pool_region) { .free_head = UINT32_MAX };
+    region_cnt = 1;
+    region_active = 0;
+    region_queue_top = UINT32_MAX;
+    release_countdown = POOL_REGION_LEN;
+    pending_head = UINT32_MAX;
+    gc_mode = gc;
+    gc_top = 0;
+    gc_cap = 0;
+    gc_pass = 0;
+    zct_len = 0;
+    zct_cap = 0;
+    zct_limit = U6A_VM_ZCT_SIZE;
+    conts_len = 0;
+    conts_cap = 0;
+    hash_cons = hash_cons_;
+    track_purity = track_purity_ && gc == u6a_vm_gc_refcount;
+    alloc_indirect = hash_cons || track_purity || gc != u6a_vm_gc_refcount;
+    if (hash_cons) {
+        hc_table = malloc(U6A_VM_HASH_CONS_SIZE * sizeof(uint32_t));
+        if (UNLIKELY(hc_table == NULL)) {
+            u6a_err_bad_alloc(err_stage, U6A_VM_HASH_CONS_SIZE * sizeof(uint32_t));
+            goto pool_init_failed;
+        }
+        memset(hc_table, 0xFF, U6A_VM_HASH_CONS_SIZE * sizeof(uint32_t));
+        hc_mask = U6A_VM_HASH_CONS_SIZE - 1;
+        hc_len = 0;
+    }
+    stats = (struct u6a_vm_pool_stats) { 0 };
     return true;
+
+    pool_init_failed:
+    u6a_vm_pool_destroy();
+    return false;
 }
 
-U6A_HOT uint32_t
-u6a_vm_pool_alloc1(struct u6a_vm_var_fn v1) {
+static inline uint32_t
+vm_pool_rc_alloc2(struct u6a_vm_var_fn v1, struct u6a_vm_var_fn v2) {
     struct vm_pool_elem* elem = vm_pool_elem_alloc();
     if (UNLIKELY(elem == NULL)) {
         return UINT32_MAX;
     }
-    elem->values = (struct u6a_vm_var_tuple) { .v1.fn = v1, .v2.ptr = NULL };
-    elem->flags = 0;
-    return elem - active_pool->elems;
+    elem->refcnt = 1;
+    elem->head.tokens[0] = v1.token;
+    elem->head.tokens[1] = v2.token;
+    elem->body.refs[0] = v1.ref;
+    elem->body.refs[1] = v2.ref;
+    return elem - pool;
+}
+
+static uint32_t
+vm_pool_hc_alloc(struct u6a_vm_var_fn v1, struct u6a_vm_var_fn v2) {
+    const uint32_t idx = hc_table[vm_pool_hc_probe(v1, v2)];
+    if (idx != UINT32_MAX) {
+        ++stats.shared;
+        if (gc_mode == u6a_vm_gc_refcount) {
+            // Refs held by values are dropped, as the existing element holds its own
+            if (v1.token.fn & U6A_VM_FN_REF) {
+                vm_pool_elem_decref(pool + v1.ref);
+            }
+            if (v2.token.fn & U6A_VM_FN_REF) {
+                vm_pool_elem_decref(pool + v2.ref);
+            }
+            vm_pool_elem_addref(pool + idx);
+        }
+        return idx;
+    }
+    // Allocation may free or move other elements, thus the slot is probed again on insertion
+    uint32_t new_idx;
+    if (gc_mode == u6a_vm_gc_refcount) {
+        new_idx = vm_pool_rc_alloc2(v1, v2);
+    } else if (gc_mode == u6a_vm_gc_tracing) {
+        new_idx = vm_pool_gc_alloc2(v1, v2);
+    } else {
+        new_idx = vm_pool_drc_alloc2(v1, v2);
+    }
+    if (UNLIKELY(new_idx == UINT32_MAX || !vm_pool_hc_insert(new_idx))) {
+        return UINT32_MAX;
+    }
+    return new_idx;
+}
+
+// Allocation other than plain refcounting, where single values are stored along with an empty one
+static uint32_t
+vm_pool_alloc_indirect(struct u6a_vm_var_fn v1, struct u6a_vm_var_fn v2) {
+    if (track_purity) {
+        const bool pure = u6a_vm_pool_pure(v1) && (v2.token.fn == 0 || u6a_vm_pool_pure(v2));
+        const uint32_t idx = hash_cons ? vm_pool_hc_alloc(v1, v2) : vm_pool_rc_alloc2(v1, v2);
+        if (pure && LIKELY(idx != UINT32_MAX)) {
+            pool[idx].refcnt |= POOL_ELEM_PURE;
+        }
+        return idx;
+    }
+    if (hash_cons) {
+        return vm_pool_hc_alloc(v1, v2);
+    }
+    return gc_mode == u6a_vm_gc_tracing ? vm_pool_gc_alloc2(v1, v2) : vm_pool_drc_alloc2(v1, v2);
 }
 
 U6A_HOT uint32_t
-u6a_vm_pool_alloc2(struct u6a_vm_var_fn v1, struct u6a_vm_var_fn v2) {
+u6a_vm_pool_alloc1(struct u6a_vm_var_fn v1) {
+    if (UNLIKELY(alloc_indirect)) {
+        return vm_pool_alloc_indirect(v1, (struct u6a_vm_var_fn) { .token = U6A_TOKEN(0, 0) });
+    }
     struct vm_pool_elem* elem = vm_pool_elem_alloc();
     if (UNLIKELY(elem == NULL)) {
         return UINT32_MAX;
     }
-    elem->values = (struct u6a_vm_var_tuple) { .v1.fn = v1, .v2.fn = v2 };
-    elem->flags = 0;
-    return elem - active_pool->elems;
+    elem->refcnt = 1;
+    elem->head.tokens[0] = v1.token;
+    elem->head.tokens[1] = U6A_TOKEN(0, 0);
+    elem->body.refs[0] = v1.ref;
+    return elem - pool;
+}
+
+U6A_HOT uint32_t
+u6a_vm_pool_alloc2(struct u6a_vm_var_fn v1, struct u6a_vm_var_fn v2) {
+    if (UNLIKELY(alloc_indirect)) {
+        return vm_pool_alloc_indirect(v1, v2);
+    }
+    return vm_pool_rc_alloc2(v1, v2);
 }
 
 U6A_HOT uint32_t
-u6a_vm_pool_alloc2_ptr(void* v1, void* v2) {
+u6a_vm_pool_alloc2_ptr(void* v1, uint32_t v2) {
+    if (UNLIKELY(gc_mode != u6a_vm_gc_refcount)) {
+        return vm_pool_uncounted_alloc2_ptr(v1, v2);
+    }
     struct vm_pool_elem* elem = vm_pool_elem_alloc();
     if (UNLIKELY(elem == NULL)) {
         return UINT32_MAX;
     }
-    elem->values = (struct u6a_vm_var_tuple) { .v1.ptr = v1, .v2.ptr = v2 };
-    elem->flags = POOL_ELEM_HOLDS_PTR;
-    return elem - active_pool->elems;
+    elem->refcnt = 1 | POOL_ELEM_HOLDS_PTR;
+    elem->head.offset = v2;
+    elem->body.ptr = v1;
+    return elem - pool;
 }
 
+// Values are moved out of an element along with the reference to it held by the caller,
+// and only get their own references when the element is shared.
 U6A_HOT union u6a_vm_var
-u6a_vm_pool_get1(uint32_t offset) {
-    return active_pool->elems[offset].values.v1;
+u6a_vm_pool_take1(uint32_t offset) {
+    struct vm_pool_elem* elem = pool + offset;
+    const union u6a_vm_var value = vm_pool_elem_value(elem, 0);
+    if (UNLIKELY(gc_mode != u6a_vm_gc_refcount)) {
+        return value;
+    }
+    if (POOL_ELEM_REFCNT(elem) == 1) {
+        if (UNLIKELY(hash_cons)) {
+            vm_pool_hc_remove(elem);
+        }
+        elem->refcnt = 0;
+        vm_pool_elem_release(elem);
+    } else {
+        vm_pool_elem_decref(elem);
+        vm_pool_value_addref(elem, 0);
+    }
+    return value;
 }
 
 U6A_HOT struct u6a_vm_var_tuple
-u6a_vm_pool_get2(uint32_t offset) {
-    return active_pool->elems[offset].values;
+u6a_vm_pool_take2(uint32_t offset) {
+    struct vm_pool_elem* elem = pool + offset;
+    const struct u6a_vm_var_tuple values = { .v1 = vm_pool_elem_value(elem, 0), .v2 = vm_pool_elem_value(elem, 1) };
+    if (UNLIKELY(gc_mode != u6a_vm_gc_refcount)) {
+        return values;
+    }
+    if (POOL_ELEM_REFCNT(elem) == 1) {
+        if (UNLIKELY(hash_cons)) {
+            vm_pool_hc_remove(elem);
+        }
+        elem->refcnt = 0;
+        vm_pool_elem_release(elem);
+    } else {
+        vm_pool_elem_decref(elem);
+        vm_pool_value_addref(elem, 0);
+        vm_pool_value_addref(elem, 1);
+    }
+    return values;
 }
 
 U6A_HOT struct u6a_vm_var_tuple
-u6a_vm_pool_get2_separate(uint32_t offset) {
-    struct vm_pool_elem* elem = active_pool->elems + offset;
-    struct u6a_vm_var_tuple values = elem->values;
-    if (elem->refcnt > 1) {
-        // Continuation having more than 1 reference should be separated before reinstatement
-        values.v1.ptr = u6a_vm_stack_dup(values.v1.ptr);
+u6a_vm_pool_take2_ptr(uint32_t offset) {
+    struct vm_pool_elem* elem = pool + offset;
+    struct u6a_vm_var_tuple values = {
+        .v1.ptr = elem->body.ptr,
+        .v2.fn.ref = elem->head.offset
+    };
+    if (UNLIKELY(gc_mode != u6a_vm_gc_refcount)) {
+        // Element may still be referred to, and drops its stack only when found dead
+        values.v1.ptr = u6a_vm_stack_addref(values.v1.ptr);
+    } else if (POOL_ELEM_REFCNT(elem) > 1) {
+        // Saved stack is shared with the one reinstating it
+        values.v1.ptr = u6a_vm_stack_addref(values.v1.ptr);
+        vm_pool_elem_decref(elem);
+    } else {
+        // Stack is handed over to the caller, and must not be discarded along with the element
+        elem->refcnt = 0;
+        vm_pool_elem_release(elem);
     }
     return values;
 }
 
 U6A_HOT void
 u6a_vm_pool_addref(uint32_t offset) {
-    ++active_pool->elems[offset].refcnt;
+    if (UNLIKELY(gc_mode != u6a_vm_gc_refcount)) {
+        return;
+    }
+    vm_pool_elem_addref(pool + offset);
 }
 
 U6A_HOT void
 u6a_vm_pool_free(uint32_t offset) {
-    struct vm_pool_elem* elem = active_pool->elems + offset;
-    fstack_top = UINT32_MAX;
-    do {
-        if (--elem->refcnt == 0) {
-            holes->elems[++holes->pos] = elem;
-            if (elem->flags & POOL_ELEM_HOLDS_PTR) {
-                // Continuation destroyed before used
-                u6a_vm_stack_discard(elem->values.v1.ptr);
-            } else {
-                free_stack_push(elem->values.v2.fn);
-                free_stack_push(elem->values.v1.fn);
-            }
+    if (UNLIKELY(gc_mode != u6a_vm_gc_refcount)) {
+        return;
+    }
+    vm_pool_elem_unref(pool + offset);
+}
+
+bool
+u6a_vm_pool_pure(struct u6a_vm_var_fn value) {
+    switch (value.token.fn) {
+        case u6a_vf_k:
+        case u6a_vf_s:
+        case u6a_vf_i:
+        case u6a_vf_v:
+            return true;
+        case u6a_vf_k1_imm:
+        case u6a_vf_s1_imm:
+            return U6A_VM_FN_IS_PURE(value.ref & 0xFF);
+        case u6a_vf_s2_imm:
+            return U6A_VM_FN_IS_PURE(value.ref & 0xFF) && U6A_VM_FN_IS_PURE(value.ref >> 16 & 0xFF);
+        case u6a_vf_k1:
+        case u6a_vf_s1:
+        case u6a_vf_s2:
+            return pool[value.ref].refcnt & POOL_ELEM_PURE;
+        default:
+            return false;
+    }
+}
+
+const struct u6a_vm_pool_stats*
+u6a_vm_pool_stats() {
+    stats.len = pool_len;
+    return &stats;
+}
+
+static void
+vm_pool_discard_range(uint32_t begin, uint32_t end) {
+    for (uint32_t idx = begin; idx < end; ++idx) {
+        struct vm_pool_elem* elem = pool + idx;
+        if (elem->refcnt & POOL_ELEM_HOLDS_PTR) {
+            elem->refcnt = 0;
+            u6a_vm_stack_discard(elem->body.ptr);
         }
-    } while ((elem = free_stack_pop()));
+    }
+}
+
+// Stacks held by continuations which are still alive are discarded along with the pool
+static void
+vm_pool_discard_stacks() {
+    if (gc_mode == u6a_vm_gc_tracing) {
+        vm_pool_discard_range(0, gc_top);
+        return;
+    }
+    // Links of pending elements are not to be taken for flags
+    while (pending_head != UINT32_MAX) {
+        struct vm_pool_elem* elem = pool + pending_head;
+        pending_head = elem->refcnt;
+        elem->refcnt = 0;
+    }
+    // References are no longer counted, as every element is dropped anyway
+    gc_mode = u6a_vm_gc_tracing;
+    for (uint32_t region = 0; region < region_cnt; ++region) {
+        const uint32_t begin = region * POOL_REGION_LEN;
+        vm_pool_discard_range(begin, begin + regions[region].used);
+    }
 }
 
 void
 u6a_vm_pool_destroy() {
-    free(active_pool);
-    free(holes);
-    free(fstack);
+    if (pool) {
+        if (regions) {
+            vm_pool_discard_stacks();
+        }
+        munmap(pool, (size_t)pool_max_len * sizeof(struct vm_pool_elem));
+    }
+    free(regions);
+    free(gc_bitmap);
+    free(gc_fwd_base);
+    free(gc_mark_stack);
+    free(zct);
+    free(conts);
+    free(hc_table);
+    pool = NULL;
+    regions = NULL;
+    gc_bitmap = NULL;
+    gc_fwd_base = NULL;
+    gc_mark_stack = NULL;
+    zct = NULL;
+    conts = NULL;
+    hc_table = NULL;
 }
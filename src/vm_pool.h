@@ -26,8 +26,20 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+struct u6a_vm_pool_stats {
+    uint64_t collections;   /* tracing collections, or reconciliations of zero count table */
+    uint64_t moved;         /* live elements moved towards the beginning of the pool */
+    uint64_t freed;         /* elements freed by reconciliation */
+    uint64_t shared;        /* allocations which found an element holding the same values */
+    uint64_t collect_nsec;  /* time spent on collection */
+    uint64_t released;      /* emptied regions returned to the operating system */
+    uint32_t live;          /* live elements after the last collection */
+    uint32_t len;           /* elements the pool has grown to */
+};
+
 bool
-u6a_vm_pool_init(uint32_t pool_len, uint32_t ins_len, const char* err_stage);
+u6a_vm_pool_init(uint32_t pool_len, uint32_t pool_max_len, bool huge_pages, enum u6a_vm_gc gc,
+                 bool hash_cons, bool track_purity, const char* err_stage);
 
 uint32_t
 u6a_vm_pool_alloc1(struct u6a_vm_var_fn v1);
@@ -36,16 +48,16 @@ uint32_t
 u6a_vm_pool_alloc2(struct u6a_vm_var_fn v1, struct u6a_vm_var_fn v2);
 
 uint32_t
-u6a_vm_pool_alloc2_ptr(void* v1, void* v2);
+u6a_vm_pool_alloc2_ptr(void* v1, uint32_t v2);
 
 union u6a_vm_var
-u6a_vm_pool_get1(uint32_t offset);
+u6a_vm_pool_take1(uint32_t offset);
 
 struct u6a_vm_var_tuple
-u6a_vm_pool_get2(uint32_t offset);
+u6a_vm_pool_take2(uint32_t offset);
 
 struct u6a_vm_var_tuple
-u6a_vm_pool_get2_separate(uint32_t offset);
+u6a_vm_pool_take2_ptr(uint32_t offset);
 
 void
 u6a_vm_pool_addref(uint32_t offset);
@@ -53,6 +65,14 @@ u6a_vm_pool_addref(uint32_t offset);
 void
 u6a_vm_pool_free(uint32_t offset);
 
+// Whether applying the value to pure ones never performs I/O or touches continuations. Values held by the pool
+// are only known to be pure with purity tracking enabled.
+bool
+u6a_vm_pool_pure(struct u6a_vm_var_fn value);
+
+const struct u6a_vm_pool_stats*
+u6a_vm_pool_stats();
+
 void
 u6a_vm_pool_destroy();
 
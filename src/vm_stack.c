@@ -23,54 +23,121 @@
 
 #include <stddef.h>
 #include <stdlib.h>
-#include <string.h>
 
+// A continuation captures the active segment by marking elements below `base`, which it sees, as immutable.
+// The stack keeps growing and shrinking above the mark, and invoking the continuation meanwhile unwinds to it.
+// Only when the mark is about to be popped (the continuation escapes its capturing frame) the whole segment
+// is left as it is, and the stack continues from a new one upon it, reading through it lazily,
+// taking a reference to each element being popped. Either way capturing and reinstating take constant time.
 struct vm_stack {
-    struct vm_stack*     prev;
+    struct vm_stack*     prev;              /* next segment in cache, for a cached segment */
+    uint32_t             prev_top;          /* top of previous segment, as seen from this one */
     uint32_t             top;
-    uint32_t             refcnt;
+    uint32_t             base;              /* continuations see elements below, zero if not captured */
+    uint32_t             refcnt;            /* active stack, continuations and next segments referring to it */
+    uint32_t             marks;             /* continuations referring to it */
+    uint32_t             len;
+    uint32_t             pass;              /* last tracing pass of the pool collector visiting it */
     struct u6a_vm_var_fn elems[];
 };
 
 static struct vm_stack* active_stack;
 static        uint32_t  stack_seg_len;
+static        uint32_t  stack_seg_max_len;
 
-const char* err_stage;
+// Segments no longer in use are kept for reuse, so that pushing and popping across a segment boundary
+// back and forth does not allocate and free a segment each time.
+static struct vm_stack* seg_cache;
+static        uint32_t  seg_cache_cnt;
+
+static struct u6a_vm_stack_stats stats;
+
+static const char* err_stage;
 
 static inline struct vm_stack*
-vm_stack_create(struct vm_stack* prev, uint32_t top) {
-    const uint32_t size = sizeof(struct vm_stack) + stack_seg_len * sizeof(struct u6a_vm_var_fn);
+vm_stack_alloc(uint32_t len) {
+    for (struct vm_stack** next = &seg_cache; *next; next = &(*next)->prev) {
+        struct vm_stack* vs = *next;
+        if (vs->len == len) {
+            *next = vs->prev;
+            --seg_cache_cnt;
+            ++stats.seg_reuses;
+            return vs;
+        }
+    }
+    const uint32_t size = sizeof(struct vm_stack) + len * sizeof(struct u6a_vm_var_fn);
     struct vm_stack* vs = malloc(size);
     if (UNLIKELY(vs == NULL)) {
         u6a_err_bad_alloc(err_stage, size);
         return NULL;
     }
+    vs->len = len;
+    ++stats.seg_allocs;
+    return vs;
+}
+
+static inline void
+vm_stack_recycle(struct vm_stack* vs) {
+    // Once the stack is destroyed, segments discarded along with the pool are not to be cached
+    if (seg_cache_cnt == U6A_VM_STACK_SEGMENT_CACHE_SIZE || active_stack == NULL) {
+        free(vs);
+        return;
+    }
+    vs->prev = seg_cache;
+    seg_cache = vs;
+    ++seg_cache_cnt;
+}
+
+static inline struct vm_stack*
+vm_stack_create(struct vm_stack* prev, uint32_t prev_top, uint32_t len, uint32_t top) {
+    struct vm_stack* vs = vm_stack_alloc(len);
+    if (UNLIKELY(vs == NULL)) {
+        return NULL;
+    }
     vs->prev = prev;
+    vs->prev_top = prev_top;
     vs->top = top;
+    vs->base = 0;
     vs->refcnt = 1;
+    vs->marks = 0;
+    vs->pass = 0;
     return vs;
 }
 
+// Segments chained onto a full one may be larger, doubling in size up to the maximum,
+// so that deep recursion splits less often. Segments on top of captured ones start small,
+// and grow to the regular size in the same way.
 static inline struct vm_stack*
-vm_stack_dup(struct vm_stack* vs) {
-    const uint32_t size = sizeof(struct vm_stack) + stack_seg_len * sizeof(struct u6a_vm_var_fn);
-    struct vm_stack* dup_stack = malloc(size);
-    if (UNLIKELY(dup_stack == NULL)) {
-        u6a_err_bad_alloc(err_stage, size);
+vm_stack_split(struct vm_stack* vs, uint32_t top) {
+    const uint32_t len = vs->len > stack_seg_max_len / 2 ? stack_seg_max_len : vs->len * 2;
+    struct vm_stack* new_stack = vm_stack_create(vs, vs->top, len, top);
+    if (UNLIKELY(new_stack == NULL)) {
+        return NULL;
+    }
+    ++stats.splits;
+    return new_stack;
+}
+
+// Leave the active segment as it is for continuations, and continue from a new one upon it
+static inline struct vm_stack*
+vm_stack_freeze(struct vm_stack* vs) {
+    struct vm_stack* new_stack = vm_stack_create(vs, vs->top, U6A_VM_MIN_STACK_SEGMENT_SIZE, UINT32_MAX);
+    if (UNLIKELY(new_stack == NULL)) {
         return NULL;
     }
-    memcpy(dup_stack, vs, sizeof(struct vm_stack) + (vs->top + 1) * sizeof(struct u6a_vm_var_fn));
-    dup_stack->refcnt = 1;
-    for (uint32_t idx = vs->top; idx < UINT32_MAX; --idx) {
+    active_stack = new_stack;
+    return new_stack;
+}
+
+static inline void
+vm_stack_free_elems(struct vm_stack* vs, uint32_t top) {
+    for (uint32_t idx = vs->top; idx != top; --idx) {
         struct u6a_vm_var_fn elem = vs->elems[idx];
         if (elem.token.fn & U6A_VM_FN_REF) {
-            u6a_vm_pool_addref(elem.ref);
+            u6a_vm_pool_free(elem.ref);
         }
     }
-    if (vs->prev) {
-        ++vs->prev->refcnt;
-    }
-    return dup_stack;
+    vs->top = top;
 }
 
 static inline void
@@ -79,13 +146,8 @@ vm_stack_free(struct vm_stack* vs) {
     do {
         prev = vs->prev;
         if (--vs->refcnt == 0) {
-            for (uint32_t idx = vs->top; idx < UINT32_MAX; --idx) {
-                struct u6a_vm_var_fn elem = vs->elems[idx];
-                if (elem.token.fn & U6A_VM_FN_REF) {
-                    u6a_vm_pool_free(elem.ref);
-                }
-            }
-            free(vs);
+            vm_stack_free_elems(vs, UINT32_MAX);
+            vm_stack_recycle(vs);
             vs = prev;
         } else {
             break;
@@ -93,25 +155,76 @@ vm_stack_free(struct vm_stack* vs) {
     } while (vs);
 }
 
-bool
-u6a_vm_stack_init(uint32_t stack_seg_len_, const char* err_stage_) {
-    stack_seg_len = stack_seg_len_;
-    err_stage = err_stage_;
-    active_stack = vm_stack_create(NULL, UINT32_MAX);
-    return active_stack != NULL;
+// Nothing left to read from the shared previous segment, skip to the one before it,
+// so that the segment is not kept alive for nothing
+static inline void
+vm_stack_prev_skip(struct vm_stack* vs) {
+    struct vm_stack* prev = vs->prev;
+    vs->prev = prev->prev;
+    vs->prev_top = prev->prev_top;
+    if (vs->prev) {
+        ++vs->prev->refcnt;
+    }
+    --prev->refcnt;
 }
 
-U6A_HOT struct u6a_vm_var_fn
-u6a_vm_stack_top() {
+// Active segment is empty, or the top element is seen by continuations,
+// look for the top element in previous ones
+static bool
+vm_stack_pop_slow(struct u6a_vm_var_fn* v0) {
     struct vm_stack* vs = active_stack;
-    if (UNLIKELY(vs->top == UINT32_MAX)) {
-        vs = vs->prev;
-        if (UNLIKELY(vs == NULL)) {
-            return (struct u6a_vm_var_fn) { 0 };
+    while (true) {
+        if (vs->marks) {
+            // Continuations escape the frame which captured them
+            vs = vm_stack_freeze(vs);
+            if (UNLIKELY(vs == NULL)) {
+                return false;
+            }
+            ++stats.escapes;
+        }
+        struct vm_stack* prev = vs->prev;
+        if (UNLIKELY(prev == NULL)) {
+            u6a_err_stack_underflow(err_stage);
+            return false;
+        }
+        if (prev->refcnt == 1 + prev->marks && (prev->marks == 0 || vs->prev_top + 1 > prev->base)) {
+            // No longer shared with other stacks, thus becomes the active segment again.
+            // Elements above the top seen from the active segment have been taken, and are dropped here.
+            vm_stack_free_elems(prev, vs->prev_top);
+            active_stack = prev;
+            ++stats.joins;
+            vm_stack_recycle(vs);
+            vs = prev;
+            if (vs->top + 1 > vs->base) {
+                *v0 = vs->elems[vs->top--];
+                return true;
+            }
+        } else if (vs->prev_top == UINT32_MAX) {
+            vm_stack_prev_skip(vs);
+        } else {
+            *v0 = prev->elems[vs->prev_top--];
+            if (v0->token.fn & U6A_VM_FN_REF) {
+                u6a_vm_pool_addref(v0->ref);
+            }
+            if (vs->prev_top == UINT32_MAX) {
+                vm_stack_prev_skip(vs);
+            }
+            ++stats.shared_pops;
+            return true;
         }
-        active_stack = vs;
     }
-    return vs->elems[vs->top];
+}
+
+bool
+u6a_vm_stack_init(uint32_t stack_seg_len_, uint32_t stack_seg_max_len_, const char* err_stage_) {
+    stack_seg_len = stack_seg_len_;
+    stack_seg_max_len = stack_seg_max_len_ > stack_seg_len ? stack_seg_max_len_ : stack_seg_len;
+    err_stage = err_stage_;
+    seg_cache = NULL;
+    seg_cache_cnt = 0;
+    stats = (struct u6a_vm_stack_stats) { 0 };
+    active_stack = vm_stack_create(NULL, UINT32_MAX, stack_seg_len, UINT32_MAX);
+    return active_stack != NULL;
 }
 
 // Boilerplates below. If only we have C++ templates here... (macros just make things nastier)
@@ -119,16 +232,15 @@ u6a_vm_stack_top() {
 U6A_HOT bool
 u6a_vm_stack_push1(struct u6a_vm_var_fn v0) {
     struct vm_stack* vs = active_stack;
-    if (LIKELY(vs->top + 1 < stack_seg_len)) {
+    if (LIKELY(vs->top + 1 < vs->len)) {
         vs->elems[++vs->top] = v0;
         return true;
     }
-    active_stack = vm_stack_create(vs, 0);
+    active_stack = vm_stack_split(vs, 0);
     if (UNLIKELY(active_stack == NULL)) {
         active_stack = vs;
         return false;
     }
-    ++vs->refcnt;
     active_stack->elems[0] = v0;
     return true;
 }
@@ -136,17 +248,16 @@ u6a_vm_stack_push1(struct u6a_vm_var_fn v0) {
 U6A_HOT bool
 u6a_vm_stack_push2(struct u6a_vm_var_fn v0, struct u6a_vm_var_fn v1) {
     struct vm_stack* vs = active_stack;
-    if (LIKELY(vs->top + 2 < stack_seg_len)) {
+    if (LIKELY(vs->top + 2 < vs->len)) {
         vs->elems[++vs->top] = v0;
         vs->elems[++vs->top] = v1;
         return true;
     }
-    active_stack = vm_stack_create(vs, 1);
+    active_stack = vm_stack_split(vs, 1);
     if (UNLIKELY(active_stack == NULL)) {
         active_stack = vs;
         return false;
     }
-    ++vs->refcnt;
     active_stack->elems[0] = v0;
     active_stack->elems[1] = v1;
     return true;
@@ -155,18 +266,17 @@ u6a_vm_stack_push2(struct u6a_vm_var_fn v0, struct u6a_vm_var_fn v1) {
 U6A_HOT bool
 u6a_vm_stack_push3(struct u6a_vm_var_fn v0, struct u6a_vm_var_tuple v12) {
     struct vm_stack* vs = active_stack;
-    if (LIKELY(vs->top + 3 < stack_seg_len)) {
+    if (LIKELY(vs->top + 3 < vs->len)) {
         vs->elems[++vs->top] = v0;
         vs->elems[++vs->top] = v12.v2.fn;
         vs->elems[++vs->top] = v12.v1.fn;
         return true;
     }
-    active_stack = vm_stack_create(vs, 2);
+    active_stack = vm_stack_split(vs, 2);
     if (UNLIKELY(active_stack == NULL)) {
         active_stack = vs;
         return false;
     }
-    ++vs->refcnt;
     active_stack->elems[0] = v0;
     active_stack->elems[1] = v12.v2.fn;
     active_stack->elems[2] = v12.v1.fn;
@@ -176,19 +286,18 @@ u6a_vm_stack_push3(struct u6a_vm_var_fn v0, struct u6a_vm_var_tuple v12) {
 U6A_HOT bool
 u6a_vm_stack_push4(struct u6a_vm_var_fn v0, struct u6a_vm_var_fn v1, struct u6a_vm_var_tuple v23) {
     struct vm_stack* vs = active_stack;
-    if (LIKELY(vs->top + 4 < stack_seg_len)) {
+    if (LIKELY(vs->top + 4 < vs->len)) {
         vs->elems[++vs->top] = v0;
         vs->elems[++vs->top] = v1;
         vs->elems[++vs->top] = v23.v2.fn;
         vs->elems[++vs->top] = v23.v1.fn;
         return true;
     }
-    active_stack = vm_stack_create(vs, 3);
+    active_stack = vm_stack_split(vs, 3);
     if (UNLIKELY(active_stack == NULL)) {
         active_stack = vs;
         return false;
     }
-    ++vs->refcnt;
     active_stack->elems[0] = v0;
     active_stack->elems[1] = v1;
     active_stack->elems[2] = v23.v2.fn;
@@ -197,58 +306,142 @@ u6a_vm_stack_push4(struct u6a_vm_var_fn v0, struct u6a_vm_var_fn v1, struct u6a_
 }
 
 U6A_HOT bool
-u6a_vm_stack_pop() {
+u6a_vm_stack_pop(struct u6a_vm_var_fn* v0) {
     struct vm_stack* vs = active_stack;
-    if (LIKELY(vs->top-- < UINT32_MAX)) {
+    if (LIKELY(vs->top + 1 > vs->base)) {
+        *v0 = vs->elems[vs->top--];
         return true;
     }
-    active_stack = vs->prev;
-    if (UNLIKELY(active_stack == NULL)) {
-        u6a_err_stack_underflow(err_stage);
-        active_stack = vs;
-        return false;
+    return vm_stack_pop_slow(v0);
+}
+
+U6A_HOT bool
+u6a_vm_stack_xch(struct u6a_vm_var_fn* v0) {
+    struct vm_stack* vs = active_stack;
+    if (LIKELY(vs->top + 1 > vs->base + 1)) {
+        const struct u6a_vm_var_fn elem = vs->elems[vs->top - 1];
+        vs->elems[vs->top - 1] = *v0;
+        *v0 = elem;
+        return true;
     }
-    if (active_stack->refcnt-- > 1) {
-        active_stack = vm_stack_dup(active_stack);
+    // Second element is not in the active segment, or is seen by continuations
+    struct u6a_vm_var_fn v_top, v_second;
+    if (UNLIKELY(!u6a_vm_stack_pop(&v_top) || !u6a_vm_stack_pop(&v_second))) {
+        return false;
     }
-    if (UNLIKELY(active_stack == NULL)) {
-        active_stack = vs;
+    if (UNLIKELY(!u6a_vm_stack_push2(*v0, v_top))) {
         return false;
-    };
-    free(vs);
+    }
+    *v0 = v_second;
     return true;
 }
 
-struct u6a_vm_var_fn
-u6a_vm_stack_xch(struct u6a_vm_var_fn v0) {
+void*
+u6a_vm_stack_save() {
     struct vm_stack* vs = active_stack;
-    struct u6a_vm_var_fn elem = vs->elems[vs->top - 1];
-    vs->elems[vs->top - 1] = v0;
-    return elem;
+    ++stats.captures;
+    if (vs->marks && vs->base != vs->top + 1) {
+        // Already captured with fewer elements, a segment holds only one mark
+        vs = vm_stack_freeze(vs);
+        if (UNLIKELY(vs == NULL)) {
+            return NULL;
+        }
+    }
+    vs->base = vs->top + 1;
+    ++vs->marks;
+    ++vs->refcnt;
+    return vs;
 }
 
 void*
-u6a_vm_stack_save() {
-    return vm_stack_dup(active_stack);
+u6a_vm_stack_addref(void* ptr) {
+    struct vm_stack* vs = ptr;
+    ++vs->marks;
+    ++vs->refcnt;
+    return vs;
 }
 
-void*
-u6a_vm_stack_dup(void* ptr) {
-    return vm_stack_dup(ptr);
+// When the captured segment is still in the active stack, and nothing else refers to the segments above it,
+// or to elements above the mark, the stack is unwound to the mark in place
+static inline bool
+vm_stack_unwind(struct vm_stack* vs, uint32_t top) {
+    uint32_t depth = 0;
+    for (struct vm_stack* seg = active_stack; seg != vs; seg = seg->prev) {
+        if (seg == NULL || seg->refcnt != 1 || ++depth > U6A_VM_STACK_MAX_UNWIND_SEGMENTS) {
+            return false;
+        }
+    }
+    // References from the segment above (or the active stack), the resuming continuation, and other marks
+    if (vs->refcnt != 2 + vs->marks) {
+        return false;
+    }
+    while (active_stack != vs) {
+        struct vm_stack* prev = active_stack->prev;
+        vm_stack_free_elems(active_stack, UINT32_MAX);
+        vm_stack_recycle(active_stack);
+        active_stack = prev;
+    }
+    --vs->refcnt;
+    vm_stack_free_elems(vs, top);
+    ++stats.unwinds;
+    return true;
 }
 
-void
+bool
 u6a_vm_stack_resume(void* ptr) {
-    u6a_vm_stack_destroy();
-    active_stack = ptr;
+    struct vm_stack* vs = ptr;
+    const uint32_t top = vs->base - 1;
+    if (--vs->marks == 0) {
+        vs->base = 0;
+    }
+    if (vm_stack_unwind(vs, top)) {
+        return true;
+    }
+    struct vm_stack* new_stack = vm_stack_create(vs, top, U6A_VM_MIN_STACK_SEGMENT_SIZE, UINT32_MAX);
+    if (UNLIKELY(new_stack == NULL)) {
+        vm_stack_free(vs);
+        return false;
+    }
+    vm_stack_free(active_stack);
+    active_stack = new_stack;
+    return true;
 }
 
 void
 u6a_vm_stack_discard(void* ptr) {
-    vm_stack_free(ptr);
+    struct vm_stack* vs = ptr;
+    if (--vs->marks == 0) {
+        vs->base = 0;
+    }
+    vm_stack_free(vs);
+}
+
+void
+u6a_vm_stack_trace(void* ptr, uint32_t pass, void (*visit)(struct u6a_vm_var_fn* elem)) {
+    // Segments below one visited in this pass have been visited as well
+    for (struct vm_stack* vs = ptr ? ptr : active_stack; vs && vs->pass != pass; vs = vs->prev) {
+        vs->pass = pass;
+        for (uint32_t idx = vs->top; idx != UINT32_MAX; --idx) {
+            visit(vs->elems + idx);
+        }
+    }
+}
+
+const struct u6a_vm_stack_stats*
+u6a_vm_stack_stats() {
+    return &stats;
 }
 
 void
 u6a_vm_stack_destroy() {
-    vm_stack_free(active_stack);
+    if (active_stack) {
+        vm_stack_free(active_stack);
+        active_stack = NULL;
+    }
+    while (seg_cache) {
+        struct vm_stack* next = seg_cache->prev;
+        free(seg_cache);
+        seg_cache = next;
+    }
+    seg_cache_cnt = 0;
 }
@@ -26,11 +26,19 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-bool
-u6a_vm_stack_init(uint32_t stack_seg_len, const char* err_stage);
+struct u6a_vm_stack_stats {
+    uint64_t splits;        /* pushes which chained a new segment */
+    uint64_t joins;         /* pops which went back to the previous segment */
+    uint64_t seg_allocs;    /* segments allocated */
+    uint64_t seg_reuses;    /* segments taken from cache instead of being allocated */
+    uint64_t captures;      /* stacks captured by continuations */
+    uint64_t escapes;       /* captured segments left behind, as continuations escaped the capturing frame */
+    uint64_t unwinds;       /* continuations resumed by unwinding the active stack in place */
+    uint64_t shared_pops;   /* elements popped from segments shared with continuations */
+};
 
-struct u6a_vm_var_fn
-u6a_vm_stack_top();
+bool
+u6a_vm_stack_init(uint32_t stack_seg_len, uint32_t stack_seg_max_len, const char* err_stage);
 
 bool
 u6a_vm_stack_push1(struct u6a_vm_var_fn v0);
@@ -47,23 +55,31 @@ bool
 u6a_vm_stack_push4(struct u6a_vm_var_fn v0, struct u6a_vm_var_fn v1, struct u6a_vm_var_tuple v23);
 
 bool
-u6a_vm_stack_pop();
+u6a_vm_stack_pop(struct u6a_vm_var_fn* v0);
 
-struct u6a_vm_var_fn
-u6a_vm_stack_xch(struct u6a_vm_var_fn v1);
+bool
+u6a_vm_stack_xch(struct u6a_vm_var_fn* v0);
 
 void*
 u6a_vm_stack_save();
 
 void*
-u6a_vm_stack_dup(void* ptr);
+u6a_vm_stack_addref(void* ptr);
 
-void
+bool
 u6a_vm_stack_resume(void* ptr);
 
 void
 u6a_vm_stack_discard(void* ptr);
 
+// Visits elements of the given saved stack (or the active stack if NULL), including those of segments shared
+// with other stacks, each at most once with the same pass number
+void
+u6a_vm_stack_trace(void* ptr, uint32_t pass, void (*visit)(struct u6a_vm_var_fn* elem));
+
+const struct u6a_vm_stack_stats*
+u6a_vm_stack_stats();
+
 void
 u6a_vm_stack_destroy();
 
@@ -0,0 +1,99 @@
+#
+# common.sh - Regression test driver, sourced by each *.test script
+#
+# Copyright (C) 2020  CismonX <admin@cismon.net>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+
+# Every program in programs/ is compiled with $U6AC_FLAGS and run with $U6A_FLAGS, and has to exit normally,
+# writing exactly what its .out file holds. $MODE is one of:
+#   bc     - bytecode run by u6a (default), or by the build of it named by $U6A_PROGRAM
+#   c      - C code written by u6ac --emit=c, or by the build of it named by $U6AC_PROGRAM, built by $CC
+#            against libu6a
+#   bundle - executable written by u6ac --bundle
+# With $DEFAULT_OUTPUT set, u6ac is not given -o, and names the output file after the source.
+# With $PIPE set, programs read their input through a pipe rather than from a file.
+# Where $STATS is given, bytecode is compiled and run with -v, and the statistics printed for at least one
+# program have to match it, so that the code under test is known to have run.
+
+: "${srcdir:=.}"
+: "${top_builddir:=..}"
+: "${top_srcdir:=$srcdir/..}"
+: "${MODE:=bc}"
+: "${CC:=cc}"
+
+u6ac="$top_builddir/src/${U6AC_PROGRAM:-u6ac}"
+u6a="$top_builddir/src/${U6A_PROGRAM:-u6a}"
+verbose=${STATS:+-v}
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/u6a-test.XXXXXX") || exit 99
+# Diagnostics are collected into one log, which is shown once the test is done
+log="$work/log"
+: > "$log"
+trap 'cat "$log" >&2; rm -rf "$work"' EXIT
+
+failed=0
+for src in "$srcdir"/programs/*.unl; do
+    name=$(basename "$src" .unl)
+    input="$srcdir/programs/$name.in"
+    [ -f "$input" ] || input=/dev/null
+    case "$MODE" in
+        bc)
+            "$u6ac" $verbose $U6AC_FLAGS -o "$work/$name.bc" "$src" >> "$log" 2>&1 || exit 99
+            run="$u6a $verbose $U6A_FLAGS $work/$name.bc"
+            ;;
+        c)
+            "$u6ac" $U6AC_FLAGS --emit=c -o "$work/$name.c" "$src" 2>> "$log" || exit 99
+            $CC -I"$top_srcdir/src" -o "$work/$name" "$work/$name.c" "$top_builddir/src/libu6a.a" $LIBS 2>> "$log" || exit 99
+            run="$work/$name $U6A_FLAGS"
+            ;;
+        bundle)
+            if [ -n "$DEFAULT_OUTPUT" ]; then
+                # Source is copied, so that the executable named after it is written into $work
+                cp "$src" "$work/$name.unl" || exit 99
+                "$u6ac" $U6AC_FLAGS --bundle "$work/$name.unl" 2>> "$log" || exit 99
+                run="$work/$name.unl.out $U6A_FLAGS"
+            else
+                "$u6ac" $U6AC_FLAGS --bundle -o "$work/$name" "$src" 2>> "$log" || exit 99
+                run="$work/$name $U6A_FLAGS"
+            fi
+            ;;
+        *)
+            echo "unknown mode $MODE" >&2
+            exit 99
+            ;;
+    esac
+    if [ -n "$PIPE" ]; then
+        cat "$input" | $run > "$work/$name.txt" 2>> "$log"
+    else
+        $run < "$input" > "$work/$name.txt" 2>> "$log"
+    fi
+    status=$?
+    if [ $status -ne 0 ]; then
+        echo "FAIL: $name exited with status $status"
+        failed=1
+    elif ! cmp -s "$srcdir/programs/$name.out" "$work/$name.txt"; then
+        echo "FAIL: $name"
+        diff "$srcdir/programs/$name.out" "$work/$name.txt"
+        failed=1
+    else
+        echo "PASS: $name"
+    fi
+done
+if [ -n "$STATS" ] && ! grep -q "$STATS" "$log"; then
+    echo "FAIL: no statistics matching \"$STATS\""
+    failed=1
+fi
+exit $failed